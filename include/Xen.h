@@ -41,6 +41,10 @@
 #define _TF_kernel_mode        0
 #define TF_kernel_mode         (1<<_TF_kernel_mode)
 
+/* Control register and MSR bits */
+#define X86_CR0_PG             (1ULL<<31)
+#define EFER_LMA               (1ULL<<10)
+
 
 #define XEN_ELFNOTE_VMCOREINFO 0U
 #define XEN_ELFNOTE_CRASH_INFO 0x1000001U
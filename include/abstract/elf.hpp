@@ -26,7 +26,10 @@
  * @author Andrew Cooper
  */
 
+#include "types.hpp"
+
 #include <cstring>
+#include <vector>
 
 #include <elf.h>
 
@@ -41,6 +44,8 @@ struct ElfProgHdr
     Elf64_Addr phys;
     /// Program header size.
     Elf64_Xword size;
+    /// Program header size in memory.  Bytes past size read as zero.
+    Elf64_Xword memsz;
 };
 
 
@@ -114,15 +119,50 @@ namespace Abstract
         /// Number of cpus.
         int nr_cpus;
 
+        /**
+         * Whether guest memory is stored compressed.  If so, PT_LOAD
+         * offsets are meaningless and pages must be read with read_page().
+         * @returns boolean.
+         */
+        virtual bool compressed() const;
+
+        /**
+         * Read and decompress a single frame of a compressed crash file.
+         * @param pfn Frame number.
+         * @param dst Destination buffer of PAGE_SIZE bytes.
+         * @throws memseek if the frame is not present.
+         * @throws memread if the frame can't be read or decompressed.
+         */
+        virtual void read_page(const uint64_t & pfn, char * dst) const;
+
         /**
          * Create an Elf file parser.
          * Opens the elf file and verifies information from the ident structure
-         * at the beginning.
+         * at the beginning.  makedumpfile compressed (diskdump) files are
+         * also accepted.
          * @param path Path to an elf crash file.
          * @returns Architecture specific Elf class, or NULL on failure.
          */
         static Elf * create(const char * path);
 
+        /**
+         * Create and parse Elf file parsers for a set of crash files which
+         * together form one crash, such as the output of makedumpfile
+         * --split.  Every file must carry the same set of cpu notes.
+         * @param paths Paths to the crash files.
+         * @param elfs Filled with one parser per path, in order.
+         * @returns boolean indicating success or failure.  On failure,
+         * elfs is left empty.
+         */
+        static bool create_set(const std::vector<const char *> & paths,
+                               std::vector<Elf *> & elfs);
+
+        /**
+         * Delete a set of Elf file parsers.
+         * @param elfs Parsers to delete.  Left empty.
+         */
+        static void delete_set(std::vector<Elf *> & elfs);
+
     protected:
         /// File descriptor
         int fd;
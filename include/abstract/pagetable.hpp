@@ -27,6 +27,7 @@
  */
 
 #include <cstring>
+#include <vector>
 #include "types.hpp"
 
 namespace Abstract
@@ -44,6 +45,42 @@ namespace Abstract
     class PageTable
     {
     public:
+        /// Physically contiguous part of a virtual range.
+        struct Extent
+        {
+            /// Machine address of the start of the extent.
+            maddr_t maddr;
+            /// Length in bytes.
+            uint64_t len;
+        };
+
+        /// Result of try_walk().
+        enum WalkStatus
+        {
+            /// Translation succeeded.
+            WALK_OK,
+            /// An entry on the walk was not present.
+            WALK_NOTPRESENT,
+            /**
+             * Any other failure, only reported by walk_many().  walk() the
+             * address for the exception.
+             */
+            WALK_ERROR
+        };
+
+        /// One address for walk_many().
+        struct Translation
+        {
+            /// Virtual address to look up.
+            vaddr_t vaddr;
+            /// Machine address result, if status is WALK_OK.
+            maddr_t maddr;
+            /// Status of the lookup.
+            WalkStatus status;
+            /// Level of the entry which was not present, if WALK_NOTPRESENT.
+            int level;
+        };
+
         /// Constructor.
         PageTable() {};
         /// Destructor.
@@ -59,11 +96,68 @@ namespace Abstract
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const = 0;
 
+        /**
+         * Perform a pagetable walk, reporting a not present translation by
+         * status rather than by throwing pagefault.  Probing sparse areas
+         * such as stacks with guard pages then costs no exception
+         * unwinding.  Other errors still throw.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page, or for WALK_NOTPRESENT, of the
+         * range known not to be present.
+         * @param level If non-null and WALK_NOTPRESENT is returned,
+         * variable to be filled with the level of the entry which was not
+         * present.
+         * @returns Status of the walk.
+         */
+        virtual WalkStatus try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                                    vaddr_t * page_end = NULL,
+                                    int * level = NULL) const;
+
+        /**
+         * Translate many virtual addresses in one call.
+         * The addresses are looked up in sorted order.  Addresses within
+         * one page, or within one range known not to be present, share a
+         * single walk.  Walks under the same upper level entries run back
+         * to back, so those entries are read once.
+         * @param translations Addresses to translate.  Results are filled
+         * in place, in the original order.
+         * @param nr Number of addresses.
+         * @throws std::bad_alloc
+         */
+        virtual void walk_many(Translation * translations, size_t nr) const;
+
         /**
          * Retrieve the root of this set of pagetables.
          * @returns cr3 equivalent for this set of pagetables.
          */
         virtual uint64_t root() const = 0;
+
+        /**
+         * Translate a virtual range into machine extents.
+         * The range is walked once per page, so once per superpage, and
+         * physically adjacent pages are merged into a single extent.
+         * @param vaddr Virtual address of the start of the range.
+         * @param len Length of the range in bytes.
+         * @param extents Vector to be filled with the extents, in virtual
+         * address order.  Any previous contents are discarded.
+         * @throws As walk().  No extents are valid if an exception is thrown.
+         */
+        virtual void translate_range(const vaddr_t & vaddr, uint64_t len,
+                                     std::vector<Extent> & extents) const;
+
+        /**
+         * Discard any cached translations.  Pagetables which don't cache
+         * need not override this.
+         */
+        virtual void invalidate() const {};
+
+        /**
+         * Discard any cached translation of a virtual address.
+         * @param vaddr Virtual address.
+         */
+        virtual void invalidate(const vaddr_t & vaddr) const { (void)vaddr; };
     };
 }
 
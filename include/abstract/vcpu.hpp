@@ -174,7 +174,9 @@ namespace Abstract
             /// VCPU is running in PV Compatibility mode (a.k.a. 32bit mode on 64bit Xen)
             CPU_PV_COMPAT = 1<<3,
             /// VCPU is an HVM VCPU
-            CPU_HVM = 1<<4
+            CPU_HVM = 1<<4,
+            /// dompt is a two dimensional walk through a HAP p2m
+            CPU_NESTED_PT = 1<<5
         };
 
         /// Runstate of this VCPU at the time of crash.
@@ -0,0 +1,182 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __X86_64_DISKDUMP_HPP__
+#define __X86_64_DISKDUMP_HPP__
+
+/**
+ * @file include/arch/x86_64/diskdump.hpp
+ */
+
+#include "arch/x86_64/elf.hpp"
+
+#include <sys/types.h>
+#include <vector>
+
+/// Signature at the start of a makedumpfile compressed crash file.
+#define KDUMP_SIGNATURE "KDUMP   "
+/// Length of the signature.
+#define KDUMP_SIG_LEN 8
+
+namespace x86_64
+{
+
+/**
+ * Parser for makedumpfile's compressed (diskdump) crash file format, as
+ * written by "makedumpfile -c/-l/-p/-z".
+ *
+ * The file contains the original elf notes, a bitmap of dumped frames and
+ * one page descriptor for each dumped frame, in frame order.  A frame's
+ * descriptor is found by counting the dumped frames below it, using a
+ * precomputed count at the start of every bitmap block.  PT_LOAD program
+ * headers are synthesised for each run of dumped frames so Memory can
+ * find them, but their contents must be fetched with read_page().
+ *
+ * Each file of a set written by makedumpfile --split carries the full
+ * bitmap, but only the descriptors and frames of its own range of frames.
+ *
+ * Frames missing from the dumped bitmap were excluded for reasons other
+ * than being zero too (e.g. -X excludes domU frames), so they are never
+ * presented as zeros.  Zero pages which were dumped share one descriptor,
+ * pd_zero, and are filled without reading the file.
+ */
+    class DiskDump : public Elf
+    {
+    public:
+        /**
+         * Constructor.
+         * @param fd File descriptor to read from.
+         */
+        DiskDump(int fd);
+
+        /// Destructor.
+        virtual ~DiskDump();
+
+        /**
+         * Parse the file headers, notes and page bitmap.
+         * @returns boolean indicating success or failure.
+         */
+        virtual bool parse();
+
+        /**
+         * Whether guest memory is stored compressed.
+         * @returns true.
+         */
+        virtual bool compressed() const;
+
+        /**
+         * Read and decompress a single frame.
+         * @param pfn Frame number.
+         * @param dst Destination buffer of PAGE_SIZE bytes.
+         * @throws memseek if the frame is not present.
+         * @throws memread if the frame can't be read or decompressed.
+         */
+        virtual void read_page(const uint64_t & pfn, char * dst) const;
+
+    protected:
+
+        /**
+         * Read the dumped frame bitmap and build the descriptor index.
+         * @param offset File offset of the bitmap.
+         * @returns boolean indicating success or failure.
+         */
+        bool parse_bitmap(uint64_t offset);
+
+        /**
+         * Read a bitmap of max_mapnr frames.
+         * @param offset File offset of the bitmap.
+         * @param words Filled with the bitmap.
+         * @returns boolean indicating success or failure.
+         */
+        bool read_bitmap(uint64_t offset, std::vector<uint64_t> & words) const;
+
+        /**
+         * Synthesise the program headers: one for the notes, and one
+         * PT_LOAD per run of dumped frames.
+         * @param note_offset File offset of the notes.
+         * @param note_size Size of the notes.
+         * @returns boolean indicating success or failure.
+         */
+        bool build_phdrs(uint64_t note_offset, uint64_t note_size);
+
+        /**
+         * Locate the shared zero page which makedumpfile writes when zero
+         * pages are not excluded, setting zero_offset if found.
+         */
+        void find_zero_page();
+
+        /**
+         * Whether a frame is present in this crash file.
+         * @param pfn Frame number.
+         * @returns boolean.
+         */
+        bool is_dumped(const uint64_t & pfn) const;
+
+        /**
+         * Index of a dumped frame's page descriptor.
+         * @param pfn Frame number.  Must be dumped.
+         * @returns descriptor index.
+         */
+        uint64_t desc_index(const uint64_t & pfn) const;
+
+        /**
+         * Read an exact number of bytes from the crash file.
+         * @param offset File offset.
+         * @param dst Destination buffer.
+         * @param n Number of bytes.
+         * @returns number of bytes read, or -1 with errno set.
+         */
+        ssize_t pread_full(uint64_t offset, void * dst, size_t n) const;
+
+        /// Block size of the file.  Always PAGE_SIZE.
+        uint32_t block_size;
+        /// Number of frames covered by the bitmap.
+        uint64_t max_mapnr;
+        /// First frame held by this file.
+        uint64_t start_pfn;
+        /// Frame after the last held by this file.
+        uint64_t end_pfn;
+        /// Number of dumped frames below start_pfn, held by other files.
+        uint64_t desc_base;
+        /// File offset of the page descriptor table.
+        uint64_t desc_offset;
+        /// File offset of the shared zero page, or 0 if none.
+        uint64_t zero_offset;
+        /// Bitmap of dumped frames.
+        std::vector<uint64_t> bitmap;
+        /// Number of dumped frames before each block of bitmap words.
+        std::vector<uint64_t> rank;
+        /// Bytes charged to the memory budget.
+        size_t budget_charge;
+    };
+
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
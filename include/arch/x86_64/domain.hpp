@@ -122,6 +122,10 @@ namespace x86_64
          */
         virtual const Abstract::PageTable & get_dompt() const;
 
+    protected:
+        /// Bytes charged to the memory budget for this domain's vcpus.
+        size_t budget_charge;
+
     private:
 
         /**
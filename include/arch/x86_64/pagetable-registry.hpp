@@ -0,0 +1,118 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __X86_64_PAGETABLE_REGISTRY_HPP__
+#define __X86_64_PAGETABLE_REGISTRY_HPP__
+
+/**
+ * @file include/arch/x86_64/pagetable-registry.hpp
+ */
+
+#include "abstract/pagetable.hpp"
+
+#include <cstddef>
+#include <map>
+#include <utility>
+
+namespace x86_64
+{
+    /**
+     * Registry of guest pagetables, shared by root.
+     *
+     * The VCPUs of a PV domain commonly share guest_table, and an active
+     * VCPU always shares it with its domain's copy of the VCPU.  Handing
+     * out one reference counted PageTable per (root, mode) lets them share
+     * its translation cache, so a cold walk is paid once rather than once
+     * per VCPU.
+     */
+    class PageTableRegistry
+    {
+    public:
+        /// Kind of pagetables.
+        enum Mode
+        {
+            /// 64bit pagetables, as PT64.
+            MODE_64,
+            /// 64bit pagetables limited to 32bit pointers, as PT64Compat.
+            MODE_COMPAT
+        };
+
+        /// Constructor.
+        PageTableRegistry();
+        /// Destructor.  Deletes any pagetables still referenced.
+        ~PageTableRegistry();
+
+        /**
+         * Get a reference to the pagetables for a root.
+         * @param root cr3 equivalent for the pagetables.
+         * @param mode Kind of pagetables.
+         * @returns Pagetables, to be released with put().
+         * @throws std::bad_alloc
+         */
+        Abstract::PageTable * get(const uint64_t & root, Mode mode);
+
+        /**
+         * Release a reference, deleting the pagetables with the last.
+         * Pagetables which didn't come from get() are deleted directly, so
+         * every VCPU's pagetables can be released the same way.
+         * @param pt Pagetables, or NULL.
+         */
+        void put(Abstract::PageTable * pt);
+
+        /// Number of distinct pagetables currently shared out.
+        size_t size() const { return this->entries.size(); }
+
+    protected:
+        /// Registry key.
+        typedef std::pair<uint64_t, int> Key;
+
+        /// Shared pagetables.
+        struct Entry
+        {
+            /// Pagetables.
+            Abstract::PageTable * pt;
+            /// Number of references handed out.
+            unsigned refs;
+        };
+
+        /// Shared pagetables, by key.
+        std::map<Key, Entry> entries;
+        /// Keys, by pagetables.
+        std::map<const Abstract::PageTable *, Key> keys;
+
+    private:
+        // @cond EXCLUDE
+        PageTableRegistry(const PageTableRegistry &);
+        PageTableRegistry & operator= (const PageTableRegistry &);
+        // @endcond
+    };
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
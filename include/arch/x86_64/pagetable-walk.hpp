@@ -38,12 +38,179 @@
  * @param maddr Machine address result of the pagetable walk.
  * @param page_end If non-null, variable to be filled with the last virtual address
  * within the page which contains vaddr.
+ * @param page_shift If non-null, variable to be filled with log2 of the size of
+ * the page which contains vaddr.
  * @throws memseek
  * @throws memread
  * @throws pagefault
  */
 void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
-                       maddr_t & maddr, vaddr_t * page_end = NULL);
+                       maddr_t & maddr, vaddr_t * page_end = NULL,
+                       unsigned * page_shift = NULL);
+
+/**
+ * Pagetable walk for 64bit mode, reporting not present entries by status
+ * rather than by throwing pagefault.
+ * @param cr3 Value of the cr3 register.
+ * @param vaddr Virtual address to look up.
+ * @param maddr Machine address result of the pagetable walk.
+ * @param page_end If non-null, variable to be filled with the last virtual address
+ * within the page which contains vaddr.
+ * @param page_shift If non-null, variable to be filled with log2 of the size of
+ * the page which contains vaddr.
+ * @returns 0 on success, or the level of the entry which was not present.
+ * @throws memseek
+ * @throws memread
+ * @throws pagefault if cr3 is invalid.
+ */
+int pagetable_try_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                          maddr_t & maddr, vaddr_t * page_end = NULL,
+                          unsigned * page_shift = NULL);
+
+/**
+ * Pagetable walk for Intel EPT.
+ * EPT has the same 4 level structure as 64bit pagetables, but an entry is
+ * present if any of its read, write or execute bits are set.
+ * @param eptp EPT pointer, or any other value with the PML4 machine address
+ * between bits 51 and 12.
+ * @param gpa Guest physical address to look up.
+ * @param maddr Machine address result of the pagetable walk.
+ * @param page_shift If non-null, variable to be filled with log2 of the size of
+ * the page which contains gpa.
+ * @throws memseek
+ * @throws memread
+ * @throws pagefault
+ */
+void ept_walk_64(const maddr_t & eptp, const uint64_t & gpa,
+                 maddr_t & maddr, unsigned * page_shift = NULL);
+
+/**
+ * Translator from guest physical to machine addresses.
+ * Implemented by a domain's p2m, for nested pagetable walks.
+ */
+class GuestPhysMap
+{
+public:
+    /// Destructor.
+    virtual ~GuestPhysMap() {};
+
+    /**
+     * Translate a guest physical address.
+     * @param gpa Guest physical address.
+     * @param maddr Machine address variable for the result.
+     * @param page_shift Variable to be filled with log2 of the size of the
+     * page which contains gpa.
+     * @throws As ept_walk_64() or pagetable_walk_64().
+     */
+    virtual void translate(const uint64_t & gpa, maddr_t & maddr,
+                           unsigned & page_shift) const = 0;
+};
+
+/**
+ * Two dimensional pagetable walk for a 64bit guest under HAP.
+ * The guest pagetables hold guest physical addresses, so each level, and
+ * the final guest physical address, are translated through the p2m.
+ * @param p2m Guest physical address translator.
+ * @param cr3 Value of the guest cr3 register.
+ * @param vaddr Guest virtual address to look up.
+ * @param maddr Machine address result of the pagetable walk.
+ * @param page_end If non-null, variable to be filled with the last virtual
+ * address of the largest page which is contiguous in both dimensions.
+ * @param page_shift If non-null, variable to be filled with log2 of the size
+ * of that page.
+ * @throws memseek
+ * @throws memread
+ * @throws pagefault
+ */
+void pagetable_walk_nested_64(const GuestPhysMap & p2m, const uint64_t & cr3,
+                              const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL,
+                              unsigned * page_shift = NULL);
+
+/// Pagetable entry present.
+#define PTE_PRESENT   (1ULL << 0)
+/// Pagetable entry writeable.
+#define PTE_RW        (1ULL << 1)
+/// Pagetable entry accessible from user mode.
+#define PTE_USER      (1ULL << 2)
+/// Pagetable entry write-through.
+#define PTE_PWT       (1ULL << 3)
+/// Pagetable entry cache disabled.
+#define PTE_PCD       (1ULL << 4)
+/// Pagetable entry global.
+#define PTE_GLOBAL    (1ULL << 8)
+/// Pagetable entry not executable.
+#define PTE_NX        (1ULL << 63)
+
+/// A run of virtual addresses mapped to contiguous machine addresses.
+struct Mapping
+{
+    /// First virtual address of the run.
+    vaddr_t vaddr;
+    /// Length of the run in bytes.
+    uint64_t len;
+    /// Machine address of vaddr.
+    maddr_t maddr;
+    /// log2 of the size of the pages making up the run.
+    unsigned page_shift;
+    /**
+     * Effective PTE_* flags.  PTE_RW and PTE_USER are only set if every
+     * level allows them, and PTE_NX is set if any level sets it.
+     */
+    uint64_t flags;
+};
+
+/**
+ * Receiver of mappings from pagetable_enumerate_64().
+ */
+class MappingVisitor
+{
+public:
+    /// Destructor.
+    virtual ~MappingVisitor() {};
+
+    /**
+     * Receive a run of mappings.
+     * @param mapping The run.
+     * @returns boolean indicating whether enumeration should continue.
+     */
+    virtual bool visit(const Mapping & mapping) = 0;
+
+    /**
+     * Decide whether to enumerate a pagetable page.  Called before the page
+     * is read, including for the PML4.
+     * @param table Machine address of the pagetable page.
+     * @param level Level of the page, 4 for the PML4 down to 1 for a PT.
+     * @param base First virtual address mapped by the page.
+     * @returns boolean indicating whether the page should be enumerated.
+     */
+    virtual bool enter_table(const maddr_t & table, int level,
+                             const vaddr_t & base)
+    {
+        (void)table; (void)level; (void)base;
+        return true;
+    }
+};
+
+/**
+ * Enumerate all present mappings of a set of 64bit pagetables.
+ * Each pagetable page is fetched with a single read rather than entry by
+ * entry, and pages shared between several entries are only read once per
+ * enumeration, memory budget permitting.  Adjacent pages of the same size
+ * and flags which are also contiguous in machine memory are merged into a
+ * single run, and runs are delivered in ascending virtual address order.
+ * Pagetable pages which can't be read are skipped.
+ * @param cr3 Value of the cr3 register.
+ * @param visitor Receiver of the mappings.
+ * @param limit Last virtual address to enumerate.
+ * @param missing If non-null, variable to be filled with the number of
+ * pagetable pages which couldn't be read.
+ * @returns boolean indicating whether the enumeration completed, rather
+ * than being stopped by the visitor.
+ */
+bool pagetable_enumerate_64(const maddr_t & cr3, MappingVisitor & visitor,
+                            const vaddr_t & limit = ~0ULL,
+                            uint64_t * missing = NULL);
 
 #endif
 
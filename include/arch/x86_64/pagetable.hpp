@@ -27,6 +27,10 @@
  */
 
 #include "abstract/pagetable.hpp"
+#include "arch/x86_64/tlb.hpp"
+#include "arch/x86_64/pagetable-walk.hpp"
+
+#include <map>
 
 namespace x86_64
 {
@@ -54,15 +58,53 @@ namespace x86_64
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const;
 
+        /**
+         * Perform a pagetable walk, reporting a not present translation by
+         * status.  Not present ranges are cached.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page, or of the not present range.
+         * @param level If non-null, variable to be filled with the level
+         * of a not present entry.
+         * @returns Status of the walk.
+         */
+        virtual WalkStatus try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                                    vaddr_t * page_end = NULL,
+                                    int * level = NULL) const;
+
         /**
          * Retrieve the root of this set of pagetables.
          * @returns cr3 equivalent for this set of pagetables.
          */
         virtual uint64_t root() const;
 
+        /// Discard all cached translations.
+        virtual void invalidate() const;
+
+        /**
+         * Discard any cached translation of a virtual address.
+         * @param vaddr Virtual address.
+         */
+        virtual void invalidate(const vaddr_t & vaddr) const;
+
+        /**
+         * Enumerate all present mappings.
+         * @param visitor Receiver of the mappings.
+         * @param missing If non-null, variable to be filled with the number
+         * of pagetable pages which couldn't be read.
+         * @returns boolean indicating whether the enumeration completed.
+         */
+        bool enumerate(MappingVisitor & visitor, uint64_t * missing = NULL) const;
+
+        /// Translation cache for these pagetables.
+        const TLB & get_tlb() const { return this->tlb; }
+
     private:
         /// Control Register 3
         uint64_t cr3;
+        /// Translation cache.
+        mutable TLB tlb;
     };
 
     /**
@@ -93,15 +135,255 @@ namespace x86_64
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const;
 
+        /**
+         * Perform a pagetable walk, reporting a not present translation by
+         * status.  Not present ranges are cached.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page, or of the not present range.
+         * @param level If non-null, variable to be filled with the level
+         * of a not present entry.
+         * @returns Status of the walk.
+         */
+        virtual WalkStatus try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                                    vaddr_t * page_end = NULL,
+                                    int * level = NULL) const;
+
         /**
          * Retrieve the root of this set of pagetables.
          * @returns cr3 equivalent for this set of pagetables.
          */
         virtual uint64_t root() const;
 
+        /// Discard all cached translations.
+        virtual void invalidate() const;
+
+        /**
+         * Discard any cached translation of a virtual address.
+         * @param vaddr Virtual address.
+         */
+        virtual void invalidate(const vaddr_t & vaddr) const;
+
+        /**
+         * Enumerate all present mappings below 4GB.
+         * @param visitor Receiver of the mappings.
+         * @param missing If non-null, variable to be filled with the number
+         * of pagetable pages which couldn't be read.
+         * @returns boolean indicating whether the enumeration completed.
+         */
+        bool enumerate(MappingVisitor & visitor, uint64_t * missing = NULL) const;
+
+        /// Translation cache for these pagetables.
+        const TLB & get_tlb() const { return this->tlb; }
+
     private:
         /// Control Register 3
         uint64_t cr3;
+        /// Translation cache.
+        mutable TLB tlb;
+    };
+
+    /**
+     * Xen pagetables, with a fast path for the direct map.
+     *
+     * Xen maps all of machine memory 1:1 from VIRT_DIRECTMAP_START, so an
+     * address in the direct map can be translated arithmetically rather
+     * than walked.  Everything else is passed on to the wrapped pagetables.
+     *
+     * The arithmetic is wrong if Xen is using PDX compression to squash
+     * holes out of the direct map, and would silently translate holes.
+     * Arithmetic is therefore only used within pages which a real walk has
+     * already found present and matching, and the fast path is disabled on
+     * a mismatch.  In verify mode, every translation is checked.
+     */
+    class DirectMapPT: public Abstract::PageTable
+    {
+    public:
+        /**
+         * Constructor.
+         * @param pt Xen pagetables.  Ownership is taken.
+         * @param verify Check every direct map translation against a real walk.
+         */
+        DirectMapPT(Abstract::PageTable * pt, bool verify);
+        /// Destructor.
+        virtual ~DirectMapPT();
+
+        /**
+         * Perform a pagetable walk.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         */
+        virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
+                          vaddr_t * page_end = NULL) const;
+
+        /**
+         * Perform a pagetable walk, reporting a not present translation by
+         * status.  Addresses outside the direct map are passed on to the
+         * wrapped pagetables.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page, or of the not present range.
+         * @param level If non-null, variable to be filled with the level
+         * of a not present entry.
+         * @returns Status of the walk.
+         */
+        virtual WalkStatus try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                                    vaddr_t * page_end = NULL,
+                                    int * level = NULL) const;
+
+        /**
+         * Retrieve the root of this set of pagetables.
+         * @returns cr3 equivalent for this set of pagetables.
+         */
+        virtual uint64_t root() const;
+
+        /// Discard all cached translations.
+        virtual void invalidate() const;
+
+        /**
+         * Discard any cached translation of a virtual address.
+         * @param vaddr Virtual address.
+         */
+        virtual void invalidate(const vaddr_t & vaddr) const;
+
+    private:
+        /// Wrapped Xen pagetables.
+        Abstract::PageTable * pt;
+        /// Check every direct map translation against a real walk.
+        bool verify;
+        /**
+         * Direct map pages checked against a real walk, keyed on their last
+         * virtual address, with the lowest virtual address checked.
+         */
+        mutable std::map<vaddr_t, vaddr_t> checked;
+        /// Whether the direct map fast path is usable.
+        mutable bool usable;
+
+        // @cond EXCLUDE
+        DirectMapPT(const DirectMapPT &);
+        DirectMapPT & operator= (const DirectMapPT &);
+        // @endcond
+    };
+
+    /**
+     * A HAP domain's p2m, translating guest physical addresses through
+     * either EPT or NPT pagetables.  NPT pagetables use the regular 64bit
+     * format.  Translations are cached, as every level of a nested walk
+     * needs one.
+     */
+    class P2M: public GuestPhysMap
+    {
+    public:
+        /**
+         * Constructor.
+         * @param table Machine address of the top level p2m table.
+         * @param ept Whether the table is in EPT format.
+         */
+        P2M(const maddr_t & table, bool ept);
+        /// Destructor.
+        virtual ~P2M();
+
+        /**
+         * Translate a guest physical address.
+         * @param gpa Guest physical address.
+         * @param maddr Machine address variable for the result.
+         * @param page_shift Variable to be filled with log2 of the size of
+         * the page which contains gpa.
+         */
+        virtual void translate(const uint64_t & gpa, maddr_t & maddr,
+                               unsigned & page_shift) const;
+
+        /// Discard all cached translations.
+        void invalidate() const;
+
+        /// Machine address of the top level p2m table.
+        maddr_t root() const { return this->table; }
+
+        /// Translation cache for the p2m.
+        const TLB & get_tlb() const { return this->tlb; }
+
+    private:
+        /// Machine address of the top level p2m table.
+        maddr_t table;
+        /// Whether the table is in EPT format.
+        bool ept;
+        /// Translation cache.
+        mutable TLB tlb;
+    };
+
+    /**
+     * Pagetables of a 64bit HVM guest under HAP.
+     *
+     * The guest's own pagetables are walked in guest physical address
+     * space, translating each level through the p2m.  Completed
+     * translations are cached, so a full two dimensional walk is only
+     * needed once per page.  A guest with paging disabled has virtual
+     * addresses equal to guest physical addresses.
+     */
+    class HAPPT: public Abstract::PageTable
+    {
+    public:
+        /**
+         * Constructor.
+         * @param p2m_table Machine address of the top level p2m table.
+         * @param ept Whether the p2m is in EPT format.
+         * @param cr3 Guest cr3.
+         * @param paging Whether the guest has paging enabled.
+         */
+        HAPPT(const maddr_t & p2m_table, bool ept, const uint64_t & cr3,
+              bool paging);
+        /// Destructor.
+        virtual ~HAPPT();
+
+        /**
+         * Perform a pagetable walk.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         */
+        virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
+                          vaddr_t * page_end = NULL) const;
+
+        /**
+         * Retrieve the root of this set of pagetables.
+         * @returns Guest cr3, which is a guest physical address.
+         */
+        virtual uint64_t root() const;
+
+        /// Discard all cached translations, including the p2m's.
+        virtual void invalidate() const;
+
+        /**
+         * Discard any cached translation of a virtual address.
+         * @param vaddr Virtual address.
+         */
+        virtual void invalidate(const vaddr_t & vaddr) const;
+
+        /// The guest's p2m.
+        const P2M & get_p2m() const { return this->p2m; }
+
+        /// Translation cache for these pagetables.
+        const TLB & get_tlb() const { return this->tlb; }
+
+    private:
+        /// The guest's p2m.
+        P2M p2m;
+        /// Guest cr3.
+        uint64_t cr3;
+        /// Whether the guest has paging enabled.
+        bool paging;
+        /// Translation cache.
+        mutable TLB tlb;
+
+        // @cond EXCLUDE
+        HAPPT(const HAPPT &);
+        HAPPT & operator= (const HAPPT &);
+        // @endcond
     };
 }
 
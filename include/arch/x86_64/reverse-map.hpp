@@ -0,0 +1,213 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __X86_64_REVERSE_MAP_HPP__
+#define __X86_64_REVERSE_MAP_HPP__
+
+/**
+ * @file include/arch/x86_64/reverse-map.hpp
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace x86_64
+{
+    /**
+     * Reverse map from machine frames to the virtual addresses mapping them.
+     *
+     * Pagetable roots are registered as they are discovered, and the index
+     * is built on demand with a single enumeration of each root.  A
+     * pagetable page which has already been enumerated at the same virtual
+     * address under an earlier root (Xen's slots in every PV guest's PML4,
+     * or two VCPUs sharing a cr3) isn't enumerated again; the later root is
+     * recorded as an alias of the earlier one for that virtual range.
+     *
+     * Mappings are stored as runs sorted by machine address, indexed by a
+     * centred interval tree.  The direct map runs are huge and overlap
+     * everything else, so a lookup descends the tree rather than scanning
+     * the runs, costing O(log n + hits).
+     */
+    class ReverseMap
+    {
+    public:
+        /// Constructor.
+        ReverseMap();
+        /// Destructor.
+        ~ReverseMap();
+
+        /// A virtual address mapping a frame.
+        struct Hit
+        {
+            /// Label of the pagetable root.
+            const char * label;
+            /// Pagetable root.
+            maddr_t cr3;
+            /// Virtual address of the start of the frame.
+            vaddr_t vaddr;
+        };
+
+        /**
+         * Register a pagetable root.  Discards any built index.
+         * @param cr3 Pagetable root.
+         * @param limit Last virtual address mapped by the root.
+         * @param fmt printf() format of the label, e.g. "d1v0".
+         */
+        void add_root(const maddr_t & cr3, const vaddr_t & limit,
+                      const char * fmt, ...)
+            __attribute__((format(printf, 4, 5)));
+
+        /**
+         * Build the index, if not already built.
+         * @returns boolean indicating success.  Fails if the memory budget
+         * refuses the index.
+         */
+        bool build();
+
+        /**
+         * Find the virtual addresses which map a frame.  build() must have
+         * succeeded.
+         * @param mfn Machine frame number.
+         * @param hits Vector to be filled with the hits.  Any previous
+         * contents are discarded.
+         */
+        void lookup(const uint64_t & mfn, std::vector<Hit> & hits) const;
+
+        /// Number of registered roots.
+        size_t nr_roots() const { return this->roots.size(); }
+        /// Number of runs in the index.
+        size_t nr_runs() const { return this->runs.size(); }
+
+    protected:
+        /// Registered pagetable root.
+        struct Root
+        {
+            /// Pagetable root.
+            maddr_t cr3;
+            /// Last virtual address mapped by the root.
+            vaddr_t limit;
+            /// Label.
+            char label[24];
+        };
+
+        /// A run of mappings in the index.
+        struct Run
+        {
+            /// Machine address of the start of the run.
+            maddr_t maddr;
+            /// Length of the run in bytes.
+            uint64_t len;
+            /// Virtual address of the start of the run.
+            vaddr_t vaddr;
+            /// Index of the root which the run was enumerated under.
+            uint32_t root;
+        };
+
+        /// A virtual range of one root which is shared with an earlier root.
+        struct Alias
+        {
+            /// Index of the root whose runs cover the range.
+            uint32_t owner;
+            /// Index of the root sharing the range.
+            uint32_t root;
+            /// First virtual address of the range.
+            vaddr_t start;
+            /// Last virtual address of the range.
+            vaddr_t end;
+        };
+
+        /**
+         * Node of the interval tree.  Each node holds the runs containing
+         * its centre; runs wholly below or above it are in the left or
+         * right subtree.
+         */
+        struct Node
+        {
+            /// Machine address which every run of this node contains.
+            maddr_t centre;
+            /// Index of the node's runs in by_start and by_end.
+            uint32_t first;
+            /// Number of runs of this node.
+            uint32_t count;
+            /// Index of the left subtree, or NO_NODE.
+            uint32_t left;
+            /// Index of the right subtree, or NO_NODE.
+            uint32_t right;
+        };
+
+        /// Null Node index.
+        static const uint32_t NO_NODE = ~0U;
+
+        /// Discard the index, returning its memory budget charge.
+        void clear();
+
+        /**
+         * Build a subtree of the interval tree.
+         * @param set Indices of the runs to place in the subtree, in
+         * ascending order.
+         * @returns Index of the subtree's node, or NO_NODE if set is empty.
+         */
+        uint32_t build_node(const std::vector<uint32_t> & set);
+
+        /**
+         * Order runs by machine address.
+         * @param a Run.
+         * @param b Run.
+         * @returns boolean indicating whether a starts below b.
+         */
+        static bool run_before(const Run & a, const Run & b)
+        {
+            return a.maddr < b.maddr;
+        }
+
+        /// Registered roots.
+        std::vector<Root> roots;
+        /// Runs, sorted by maddr once built.
+        std::vector<Run> runs;
+        /// Interval tree over runs, rooted at nodes[0].
+        std::vector<Node> nodes;
+        /// Run indices of each node, by ascending start address.
+        std::vector<uint32_t> by_start;
+        /// Run indices of each node, by descending last address.
+        std::vector<uint32_t> by_end;
+        /// Aliases.
+        std::vector<Alias> aliases;
+        /// Whether the index is built.
+        bool built;
+        /// Bytes charged to the memory budget.
+        size_t budget_charge;
+
+        friend class RmapBuilder;
+    };
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,166 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __X86_64_TLB_HPP__
+#define __X86_64_TLB_HPP__
+
+/**
+ * @file include/arch/x86_64/tlb.hpp
+ */
+
+#include <cstddef>
+#include "types.hpp"
+
+namespace x86_64
+{
+    /**
+     * Software TLB.
+     * Caches the results of pagetable walks for one set of pagetables, keyed
+     * on virtual page.  As in hardware, each page size has its own small
+     * direct-mapped set, so a superpage is cached once rather than once per
+     * 4K page within it.
+     *
+     * Not present entries are cached separately, per pagetable level, as
+     * the whole range which the entry would have mapped.  Other faults are
+     * not cached.
+     *
+     * Entries are allocated on first insert and charged to the memory budget.
+     * If the budget refuses, the TLB stays empty and every lookup misses.
+     *
+     * Not thread safe.  Pagetables are only walked from the main thread.
+     */
+    class TLB
+    {
+    public:
+        /// Constructor.
+        TLB();
+        /// Destructor.
+        ~TLB();
+
+        /**
+         * Look up a virtual address.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @param page_shift If non-null, variable to be filled with log2 of
+         * the size of the page.
+         * @returns boolean indicating a hit.
+         */
+        bool lookup(const vaddr_t & vaddr, maddr_t & maddr,
+                    vaddr_t * page_end, unsigned * page_shift = NULL);
+
+        /**
+         * Insert the result of a pagetable walk.
+         * @param vaddr Virtual address which was walked.
+         * @param maddr Machine address result of the walk.
+         * @param page_shift log2 of the size of the page which maps vaddr.
+         */
+        void insert(const vaddr_t & vaddr, const maddr_t & maddr,
+                    unsigned page_shift);
+
+        /**
+         * Look up a virtual address in the not present ranges.
+         * @param vaddr Virtual address to look up.
+         * @param level Variable for the level of the not present entry.
+         * @param range_end If non-null, variable to be filled with the last
+         * virtual address of the not present range.
+         * @returns boolean indicating a hit.
+         */
+        bool lookup_absent(const vaddr_t & vaddr, int & level,
+                           vaddr_t * range_end);
+
+        /**
+         * Insert a not present result of a pagetable walk.
+         * @param vaddr Virtual address which was walked.
+         * @param level Level of the entry which was not present, 1 to 4.
+         */
+        void insert_absent(const vaddr_t & vaddr, int level);
+
+        /// Discard all entries.
+        void flush();
+
+        /**
+         * Discard any entry mapping a virtual address.
+         * @param vaddr Virtual address.
+         */
+        void flush(const vaddr_t & vaddr);
+
+        /// Number of lookups satisfied from the TLB.
+        uint64_t nr_hits() const { return this->hits; }
+        /// Number of lookups not satisfied from the TLB.
+        uint64_t nr_misses() const { return this->misses; }
+        /// Number of lookups satisfied from the not present ranges.
+        uint64_t nr_absent_hits() const { return this->absent_hits; }
+        /// Number of flushes.
+        uint64_t nr_flushes() const { return this->flushes; }
+
+    protected:
+        /// TLB entry.
+        struct Entry
+        {
+            /// Virtual address shifted right by the page shift, or ~0 if unused.
+            uint64_t tag;
+            /// Machine address of the start of the page.
+            maddr_t base;
+        };
+
+        /**
+         * Entries for all page sizes, followed by the not present ranges
+         * for all levels, or NULL if not yet allocated.
+         */
+        Entry * entries;
+        /// Whether the memory budget refused the entries.
+        bool refused;
+
+        /// Hit counter.
+        uint64_t hits;
+        /// Miss counter.
+        uint64_t misses;
+        /// Not present range hit counter.
+        uint64_t absent_hits;
+        /// Flush counter.
+        uint64_t flushes;
+
+        /**
+         * Allocate the entries, if not already allocated.
+         * @returns boolean indicating whether entries are available.
+         */
+        bool allocate();
+
+    private:
+        // @cond EXCLUDE
+        TLB(const TLB &);
+        TLB & operator= (const TLB &);
+        // @endcond
+    };
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
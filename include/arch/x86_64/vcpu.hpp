@@ -30,6 +30,8 @@
 
 #include "arch/x86_64/structures.hpp"
 
+class StructSnapshot;
+
 namespace x86_64
 {
 
@@ -154,6 +156,24 @@ namespace x86_64
          */
         virtual bool parse_seg_regs(const vaddr_t & addr, const Abstract::PageTable & xenpt);
 
+        /**
+         * Parse the guest control state and p2m needed for walking the
+         * pagetables of a HAP guest.
+         *
+         * @param vcpu Snapshot of Xen's struct vcpu.
+         * @param xenpt PageTable with which translations can be performed.
+         * @return boolean indicating success or failure.
+         */
+        bool parse_hap(const StructSnapshot & vcpu, const Abstract::PageTable & xenpt);
+
+        /**
+         * Create two dimensional pagetables for a HAP guest.
+         *
+         * @param src VCPU whose guest control state and p2m should be used.
+         * @return New pagetables, or NULL if the guest can't be walked.
+         */
+        Abstract::PageTable * new_hap_pagetable(const VCPU & src) const;
+
         /// struct arch_vcpu.flags
         uint64_t arch_flags;
         /// struct arch_vcpu.guest_table_user
@@ -161,6 +181,15 @@ namespace x86_64
         /// struct arch_vcpu.guest_table
         maddr_t guest_table;
 
+        /// struct arch_vcpu.hvm_vcpu.guest_cr[0]
+        uint64_t hvm_guest_cr0;
+        /// struct arch_vcpu.hvm_vcpu.guest_cr[3]
+        uint64_t hvm_guest_cr3;
+        /// struct arch_vcpu.hvm_vcpu.guest_efer
+        uint64_t hvm_guest_efer;
+        /// Machine address of the domain's top level p2m table, if HAP.
+        maddr_t p2m_table;
+
         /// Register values
         x86_64regs regs;
     };
@@ -62,6 +62,15 @@ namespace xensyms
     /// Offset of is_32bit_pv in Xen's struct arch_domain.
     extern vaddr_t DOMAIN_is_32bit_pv;
 
+    /// Offset of arch.hvm_vcpu.guest_cr in Xen's struct vcpu.
+    extern vaddr_t VCPU_hvm_guest_cr;
+    /// Offset of arch.hvm_vcpu.guest_efer in Xen's struct vcpu.
+    extern vaddr_t VCPU_hvm_guest_efer;
+    /// Offset of arch.p2m in Xen's struct domain.
+    extern vaddr_t DOMAIN_p2m;
+    /// Offset of phys_table in Xen's struct p2m_domain.
+    extern vaddr_t P2M_phys_table;
+
     /// Xen's per_cpu__curr_vcpu symbol.
     extern vaddr_t per_cpu__curr_vcpu;
     /// Xen's __per_cpu_offset symbol
@@ -75,6 +84,7 @@ namespace xensyms
     DECLARE_XENSYM_GROUP(x86_64_vcpu);
     DECLARE_XENSYM_GROUP(x86_64_domain);
     DECLARE_XENSYM_GROUP(x86_64_per_cpu);
+    DECLARE_XENSYM_GROUP(x86_64_hap);
     /// @endcond
 
     /**
@@ -0,0 +1,92 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __ASYNC_IO_HPP__
+#define __ASYNC_IO_HPP__
+
+/**
+ * @file include/async-io.hpp
+ */
+
+#include "types.hpp"
+
+#include <vector>
+#include <sys/uio.h>
+
+/**
+ * Asynchronous read engine.
+ * Keeps many independent reads of the CORE file(s) in flight at once.  Uses
+ * io_uring when built with liburing (USE_LIBURING=y) and the running
+ * kernel supports it, and a small pool of pread() threads otherwise.
+ */
+class AsyncIO
+{
+public:
+    /// A single vectored read.
+    struct Request
+    {
+        /// File descriptor to read from.
+        int fd;
+        /// File offset.
+        uint64_t offset;
+        /// Destination vector.
+        struct iovec * iov;
+        /// Number of entries in iov.
+        int iovcnt;
+        /// Bytes read, or -errno on failure.
+        ssize_t result;
+    };
+
+    /**
+     * Create an asynchronous read engine.
+     * @param depth Maximum number of reads in flight.
+     * @returns Engine, or NULL if none could be created.
+     */
+    static AsyncIO * create(unsigned depth);
+
+    /// Destructor.
+    virtual ~AsyncIO() {};
+
+    /**
+     * Perform a set of reads, returning once they have all completed.
+     * A read is not retried when short; its result says how much was read.
+     * @param reqs Reads to perform.
+     */
+    virtual void read_all(std::vector<Request> & reqs) = 0;
+
+    /// Name of the engine, for logging.
+    virtual const char * name() const = 0;
+
+protected:
+    /// Constructor.
+    AsyncIO() {};
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
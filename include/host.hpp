@@ -34,6 +34,8 @@
 #include "abstract/elf.hpp"
 #include "abstract/payload.hpp"
 #include "arch/x86_64/structures.hpp"
+#include "arch/x86_64/reverse-map.hpp"
+#include "arch/x86_64/pagetable-registry.hpp"
 
 /**
  * Host information.
@@ -101,6 +103,14 @@ public:
      */
     const Abstract::PageTable & get_xenpt() const;
 
+    /**
+     * Log the virtual addresses which map each of a set of frames, in Xen's
+     * pagetables and in the pagetables of the domains printed.
+     * @param mfns Machine frame numbers.
+     * @returns boolean indicating success or failure.
+     */
+    bool print_reverse_map(const std::vector<uint64_t> & mfns);
+
     /**
      * Parse a VMCOREINFO ELF note.
      * @param note The ELF note to parse.
@@ -150,6 +160,8 @@ public:
     bool debug_build;
     /// Have we got the virtual address information from the symbol table?
     bool can_validate_xen_vaddr;
+    /// Check every Xen direct map translation against a pagetable walk?
+    bool verify_directmap;
 
     /// Xen vmcoreinfo
     CoreInfo xen_vmcoreinfo;
@@ -157,6 +169,12 @@ public:
     /// dom0 vmcoreinfo
     CoreInfo dom0_vmcoreinfo;
 
+    /// Reverse map over all pagetables found.
+    x86_64::ReverseMap rmap;
+
+    /// Guest pagetables, shared between VCPUs with the same root.
+    x86_64::PageTableRegistry ptregistry;
+
 protected:
     bool decode_payloads();
     int print_payloads(FILE *o);
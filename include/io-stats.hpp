@@ -0,0 +1,191 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __IO_STATS_HPP__
+#define __IO_STATS_HPP__
+
+/**
+ * @file include/io-stats.hpp
+ */
+
+#include "types.hpp"
+
+/// Callers which I/O statistics are attributed to.
+enum IOStatTag
+{
+    /// Anything not otherwise tagged.
+    IOSTAT_OTHER = 0,
+    /// Xen and PCPU decode.
+    IOSTAT_XEN,
+    /// Domain and VCPU decode.
+    IOSTAT_DOMAIN,
+    /// Stack printing.
+    IOSTAT_STACK,
+    /// Console rings.
+    IOSTAT_CONSOLE,
+    /// Livepatch payloads.
+    IOSTAT_PAYLOAD,
+    /// Number of tags.
+    IOSTAT_NR
+};
+
+/// Number of log2 read size histogram buckets.
+#define IOSTAT_HIST_BUCKETS 24
+
+/**
+ * I/O statistics.
+ * Counts core file activity, attributed to the caller tag of the current
+ * thread, which is set with IOStatScope.  Counting is off unless enabled,
+ * and costs a single branch when off.
+ */
+class IOStats
+{
+public:
+    /// Constructor.
+    IOStats();
+
+    /// Whether statistics are being collected.
+    bool enabled;
+
+    /**
+     * Count a read of physical memory.
+     * @param bytes Size of the read.
+     */
+    void count_read(uint64_t bytes)
+    {
+        if ( this->enabled )
+        {
+            Counters & c = this->counters[IOStats::current];
+            int b = bytes ? 64 - __builtin_clzll(bytes) : 0;
+
+            __sync_fetch_and_add(&c.reads, 1);
+            __sync_fetch_and_add(&c.bytes, bytes);
+            __sync_fetch_and_add(&c.hist[b < IOSTAT_HIST_BUCKETS ? b : IOSTAT_HIST_BUCKETS-1], 1);
+        }
+    }
+
+    /// Count a memory region lookup.
+    void count_lookup()
+    {
+        if ( this->enabled )
+            __sync_fetch_and_add(&this->counters[IOStats::current].lookups, 1);
+    }
+
+    /// Count a pagetable walk.
+    void count_walk()
+    {
+        if ( this->enabled )
+            __sync_fetch_and_add(&this->counters[IOStats::current].walks, 1);
+    }
+
+    /// Count a read of a pagetable entry.  Also counted as a read.
+    void count_pt_read()
+    {
+        if ( this->enabled )
+            __sync_fetch_and_add(&this->counters[IOStats::current].pt_reads, 1);
+    }
+
+    /// Count a pagetable walk avoided by a TLB hit.
+    void count_tlb_hit()
+    {
+        if ( this->enabled )
+            __sync_fetch_and_add(&this->counters[IOStats::current].tlb_hits, 1);
+    }
+
+    /// Count an exception.
+    void count_exception()
+    {
+        if ( this->enabled )
+            __sync_fetch_and_add(&this->counters[IOStats::current].exceptions, 1);
+    }
+
+    /// Log the statistics, if enabled.
+    void log() const;
+
+    /// Caller tag of the current thread.
+    static __thread IOStatTag current;
+
+protected:
+    /// Counters for a single caller tag.
+    struct Counters
+    {
+        /// Physical memory reads.
+        uint64_t reads;
+        /// Bytes read.
+        uint64_t bytes;
+        /// Memory region lookups.
+        uint64_t lookups;
+        /// Pagetable walks.
+        uint64_t walks;
+        /// Pagetable entry reads.
+        uint64_t pt_reads;
+        /// TLB hits.
+        uint64_t tlb_hits;
+        /// Exceptions raised.
+        uint64_t exceptions;
+        /// Read sizes.  Bucket b counts reads of [2^(b-1), 2^b) bytes.
+        uint64_t hist[IOSTAT_HIST_BUCKETS];
+    };
+
+    /// Counters, indexed by caller tag.
+    Counters counters[IOSTAT_NR];
+};
+
+/**
+ * Attribute I/O statistics to a caller for the lifetime of this object.
+ * Scopes nest; the previous tag is restored on destruction.
+ */
+class IOStatScope
+{
+public:
+    /**
+     * Constructor.
+     * @param tag Caller tag.
+     */
+    IOStatScope(IOStatTag tag): prev(IOStats::current)
+    {
+        IOStats::current = tag;
+    }
+
+    /// Destructor.
+    ~IOStatScope()
+    {
+        IOStats::current = this->prev;
+    }
+
+private:
+    /// Tag to restore.
+    IOStatTag prev;
+};
+
+/// I/O statistics
+extern IOStats iostats;
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
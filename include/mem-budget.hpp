@@ -0,0 +1,113 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __MEM_BUDGET_HPP__
+#define __MEM_BUDGET_HPP__
+
+/**
+ * @file include/mem-budget.hpp
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+
+/**
+ * Process-wide memory budget.
+ * The kdump kernel has a small memory reservation, so rather than waiting
+ * for std::bad_alloc, caches, buffers and per-domain objects charge their
+ * allocations here.  Optional allocations are refused once the limit is
+ * reached, and optional work is skipped once usage passes the pressure
+ * threshold, leaving headroom for the allocations we can't do without.
+ */
+class MemBudget
+{
+public:
+    /// Constructor.
+    MemBudget();
+
+    /**
+     * Set the limit from MemAvailable, unless one has been set explicitly.
+     * Must be called before anything is charged.
+     */
+    void setup();
+
+    /**
+     * Set the limit explicitly.
+     * @param bytes Limit in bytes.  0 means unlimited.
+     */
+    void set_limit(size_t bytes);
+
+    /**
+     * Charge an optional allocation.
+     * @param bytes Size of the allocation.
+     * @returns boolean indicating whether the allocation fits in the budget.
+     * If false, nothing has been charged.
+     */
+    bool charge(size_t bytes);
+
+    /**
+     * Charge an allocation which will be made regardless of the budget.
+     * @param bytes Size of the allocation.
+     */
+    void charge_required(size_t bytes);
+
+    /**
+     * Return a charge.
+     * @param bytes Size of the allocation.
+     */
+    void uncharge(size_t bytes);
+
+    /**
+     * Is memory under pressure?  Optional work should be skipped.
+     * @returns boolean.
+     */
+    bool pressure() const;
+
+    /// Log usage statistics.
+    void log() const;
+
+protected:
+    /// Limit in bytes, or 0 for unlimited.
+    size_t limit;
+    /// Whether limit was set explicitly.
+    bool explicit_limit;
+    /// Bytes currently charged.
+    size_t usage;
+    /// Highest value of usage.
+    size_t peak;
+    /// Number of optional allocations refused.
+    uint64_t refused;
+};
+
+/// Memory budget
+extern MemBudget membudget;
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -27,13 +27,17 @@
  */
 
 #include <vector>
+#include <set>
 
 #include "types.hpp"
 #include "exceptions.hpp"
 #include "abstract/pagetable.hpp"
 #include "abstract/elf.hpp"
+#include "page-cache.hpp"
+#include "async-io.hpp"
 
 #include <cstdio>
+#include <pthread.h>
 
 using Abstract::PageTable;
 
@@ -51,6 +55,8 @@ public:
     MemRegion(const ElfProgHdr & hdr);
     /// Copy Constructor.
     MemRegion(const MemRegion & rhs);
+    /// Assignment operator.
+    MemRegion & operator= (const MemRegion & rhs);
 
     /// Starting physical address.
     maddr_t start;
@@ -58,6 +64,25 @@ public:
     uint64_t length;
     /// Offset of memory region into core file.
     uint64_t offset;
+    /// Index of the core file of a set which holds the region.
+    size_t file;
+    /**
+     * Whether the region is known to be zero but isn't stored in the core
+     * file, such as the tail of a PT_LOAD past p_filesz, or frames
+     * makedumpfile excluded as zero.  Reads are satisfied without I/O.
+     */
+    bool zero;
+
+    /**
+     * Pointer to the first byte of the region, if the region has been
+     * mmap()'d from the core file, or NULL if reads must go via the file
+     * descriptor.  The mapping is owned by Memory.
+     */
+    const char * map;
+    /// Page aligned base of the mapping, for munmap().
+    void * map_base;
+    /// Length of the mapping, for munmap().
+    size_t map_len;
 
     /**
      * Operator < for sorting purposes.
@@ -67,10 +92,91 @@ public:
     bool operator < (const MemRegion & rhs) const;
 };
 
+/**
+ * Batch of independent reads.
+ * Collects (address, length, destination) requests so Memory can service
+ * them together.  Addresses are machine or virtual, depending on whether
+ * the batch is passed to Memory::read_batch() or Memory::read_batch_vaddr().
+ */
+class ReadBatch
+{
+public:
+    /// A single read request.
+    struct Entry
+    {
+        /// Machine or virtual address.
+        uint64_t addr;
+        /// Destination buffer.
+        char * dst;
+        /// Length of the read.
+        ssize_t n;
+    };
+
+    /// Constructor.
+    ReadBatch();
+
+    /**
+     * Queue a read of a block of bytes.
+     * @param addr Address.
+     * @param dst Destination buffer.
+     * @param n Length of buffer.
+     */
+    void add(const uint64_t & addr, char * dst, ssize_t n);
+
+    /**
+     * Queue a read of an 8 bit integer.
+     * @param addr Address.
+     * @param dst Destination integer.
+     */
+    void add(const uint64_t & addr, uint8_t & dst);
+
+    /**
+     * Queue a read of a 16 bit integer.
+     * @param addr Address.
+     * @param dst Destination integer.
+     */
+    void add(const uint64_t & addr, uint16_t & dst);
+
+    /**
+     * Queue a read of a 32 bit integer.
+     * @param addr Address.
+     * @param dst Destination integer.
+     */
+    void add(const uint64_t & addr, uint32_t & dst);
+
+    /**
+     * Queue a read of a 64 bit integer.
+     * @param addr Address.
+     * @param dst Destination integer.
+     */
+    void add(const uint64_t & addr, uint64_t & dst);
+
+    /// Queued reads.
+    std::vector<Entry> entries;
+};
+
 /**
  * Memory
  * Provide a contiguous view of memory using the ELF CORE PT_LOAD
  * regions as a reference.
+ *
+ * Where possible, each region is mmap()'d from the core file so reads
+ * become plain loads.  Regions which can't be mapped (e.g. /proc/vmcore
+ * on kernels without mmap() support, or a 32bit kdump kernel with
+ * insufficient address space) fall back to reading from the file
+ * descriptor.
+ *
+ * All reads from the file descriptor use positional I/O (pread64()),
+ * so no file offset is shared between callers.  Once setup() has
+ * returned, Memory is safe to use concurrently from multiple threads.
+ * The state updated by reads is the last-hit region hint, which is a
+ * single word validated before every use, and counters and transfer
+ * capability flags, which are only accessed with __sync builtins.
+ *
+ * Frames read via the file descriptor are kept in a bounded page cache,
+ * as page table pages, domain and vcpu structures and stacks are read
+ * many times over.  Mapped regions bypass the cache, as the kernel page
+ * cache already serves them.
  */
 class Memory
 {
@@ -83,11 +189,76 @@ public:
     /**
      * Set up the memory regions
      * @param path Path of the ELF CORE file.
-     * @param elf Elf parser.
+     * @param elf Elf parser.  For compressed crash files, frames are read
+     * through elf, so it must outlive any reads.
      * @return boolean indicating success or failure.
      */
     bool setup(const char * path, const Abstract::Elf * elf);
 
+    /**
+     * Set up from a set of CORE files which together form one physical
+     * address space, such as the output of makedumpfile --split.  Each
+     * file has its own descriptors, and reads are dispatched by region.
+     * Batched reads of different files are performed in parallel.
+     * @param paths Paths to the CORE files.
+     * @param elfs Elf parsers, one per path.  As for setup(), these
+     * must outlive any reads of compressed crash files.
+     * @return boolean indicating success or failure.
+     */
+    bool setup(const std::vector<const char *> & paths,
+               const std::vector<const Abstract::Elf *> & elfs);
+
+    /// Whether setup() should try to mmap() the core file regions.
+    bool use_mmap;
+
+    /**
+     * Whether setup() should try to open the core file with O_DIRECT.
+     * If successful, the kernel page cache is bypassed entirely and the
+     * page cache caches blocks of the file instead of frames.
+     */
+    bool use_direct;
+
+    /**
+     * Set the byte budget of the page cache.
+     * @param bytes Maximum bytes of cached frames.  0 disables the cache.
+     */
+    void set_cache_budget(size_t bytes);
+
+    /**
+     * Set the number of reads read_batch() may keep in flight at once.
+     * Takes effect at setup().
+     * @param depth Queue depth.  0 performs reads synchronously.
+     */
+    void set_async_depth(unsigned depth);
+
+    /// Release cached frames, to relieve memory pressure.
+    void shrink();
+
+    /// Log page cache statistics.
+    void log_stats() const;
+
+    /**
+     * Number of bytes the calling thread has read from zero regions.
+     * Compare before and after a read to tell whether any of it was
+     * synthesised rather than read from the core file.
+     * @returns byte count.
+     */
+    static uint64_t zero_fills();
+
+    /// Start recording every frame read, for write_mini_core().
+    void record_frames();
+
+    /**
+     * Write the recorded frames out as a new ELF core.  PT_LOAD headers
+     * cover the recorded frames, clipped to the original regions, and the
+     * original notes are copied, so the analyser reads identical data
+     * from the result.
+     * @param path Path of the new core file.
+     * @param elf Elf parser of the original core, for its notes.
+     * @returns boolean indicating success or failure.
+     */
+    bool write_mini_core(const char * path, const Abstract::Elf * elf) const;
+
     /**
      * Read a string from machine address addr.
      * Reads n-1 bytes starting at addr, and places a NULL terminator position n in dst
@@ -129,6 +300,31 @@ public:
     void read_block_vaddr(const PageTable & pt, const vaddr_t & addr, char * dst, ssize_t n) const;
 
 
+    /**
+     * Read a batch of machine addresses.
+     * Reads which can't be satisfied from mappings or the page cache are
+     * sorted by core file offset, coalesced, and read with as few preadv()
+     * calls as possible.  Gaps of up to a page between neighbouring reads
+     * are read and discarded, as one larger read is cheaper than two.
+     * Independent runs are issued concurrently if asynchronous reads have
+     * been enabled.
+     * @param batch Reads to perform, with machine addresses.
+     * @throws memseek
+     * @throws memread
+     */
+    void read_batch(const ReadBatch & batch) const;
+
+    /**
+     * Read a batch of virtual addresses.
+     * Translates every read, then performs them as per read_batch().
+     * @param pt PageTable to perform pagetable walks with.
+     * @param batch Reads to perform, with virtual addresses.
+     * @throws pagefault
+     * @throws memseek
+     * @throws memread
+     */
+    void read_batch_vaddr(const PageTable & pt, const ReadBatch & batch) const;
+
     /**
      * Read a 8 bit integer from addr.
      * Reads 1 bytes from addr into dst.
@@ -200,6 +396,10 @@ public:
     /**
      * Writes a block of from addr into the specified file.
      * Reads n bytes starting at addr into file.
+     *
+     * When file is a regular file, large spans of unmapped regions are
+     * transferred in the kernel with copy_file_range() or sendfile(),
+     * without passing through userspace.
      * @param addr Machine address.
      * @param file Destination file reference.
      * @param n Length of buffer.
@@ -221,18 +421,199 @@ public:
 protected:
 
     /**
-     * Seek the CORE file to the byte representing the machine address addr.
-     * @param addr Machine address to seek to.
-     * @returns boolean indicating success or failure.
+     * Find the memory region containing machine address addr.
+     * Checks the last-hit region first, then binary searches the sorted
+     * regions, so the cost stays flat with thousands of PT_LOAD headers.
+     * @param addr Machine address to look up.
+     * @throws memseek
+     * @returns Memory region containing addr.
+     */
+    const MemRegion & find_region(const maddr_t & addr) const;
+
+    /**
+     * Try to mmap() a memory region from the core file.
+     * Failure is not fatal; the region will be read via the file descriptor.
+     * @param region Memory region to map.
+     * @param file_size Size of the core file, or 0 if unknown.
+     * @returns boolean indicating whether the region was mapped.
      */
-    void seek(const maddr_t & addr) const;
+    bool map_region(MemRegion & region, uint64_t file_size);
 
-    /// Vector of memory regions.
+    /**
+     * Read bytes from the CORE file at the offset representing the machine
+     * address addr.
+     * @param region Memory region containing addr.
+     * @param addr Machine address to read from.
+     * @param dst Destination buffer.
+     * @param n Number of bytes to read.  Must not exceed the end of region.
+     * @throws memread
+     */
+    void pread_region(const MemRegion & region, const maddr_t & addr,
+                      char * dst, ssize_t n) const;
+
+    /**
+     * Transfer bytes from the CORE file to another file descriptor without
+     * copying through userspace.  Methods found to be unsupported by the
+     * CORE file are not retried.
+     * @param region Memory region containing addr.
+     * @param addr Machine address to transfer from.
+     * @param out_fd Destination file descriptor.
+     * @param n Number of bytes.  Must not exceed the end of region.
+     * @returns number of bytes transferred, which may be short.
+     */
+    ssize_t transfer_region(const MemRegion & region, const maddr_t & addr,
+                            int out_fd, ssize_t n) const;
+
+    /**
+     * Read bytes from the CORE file at a file offset.
+     * @param file Index of the CORE file.
+     * @param foffset Offset into the CORE file.
+     * @param addr Machine address being read, for error reporting.
+     * @param dst Destination buffer.
+     * @param n Number of bytes to read.
+     * @throws memread
+     */
+    void pread_file(size_t file, uint64_t foffset, const maddr_t & addr,
+                    char * dst, ssize_t n) const;
+
+    /**
+     * Read bytes from the CORE file via the O_DIRECT descriptor.  Small
+     * reads go through the page cache, one aligned block at a time.
+     * Larger reads are streamed through an aligned bounce buffer.
+     * @param file Index of the CORE file.
+     * @param foffset Offset into the CORE file.
+     * @param addr Machine address being read, for error reporting.
+     * @param dst Destination buffer.
+     * @param n Number of bytes to read.
+     * @throws memread
+     */
+    void pread_direct(size_t file, uint64_t foffset, const maddr_t & addr,
+                      char * dst, ssize_t n) const;
+
+    /// A read from the CORE file, used by read_batch().
+    struct FileRead
+    {
+        /// Index of the CORE file.
+        size_t file;
+        /// Offset into the CORE file.
+        uint64_t foffset;
+        /// Machine address, for error reporting.
+        maddr_t addr;
+        /// Destination buffer.
+        char * dst;
+        /// Length of the read.
+        ssize_t n;
+
+        /**
+         * Operator < for sorting by file, then file offset.
+         * @param rhs Right hand side of the expression.
+         * @returns boolean.
+         */
+        bool operator < (const FileRead & rhs) const
+        {
+            if ( this->file != rhs.file )
+                return this->file < rhs.file;
+            return this->foffset < rhs.foffset;
+        }
+    };
+
+    /**
+     * Perform a set of file reads, coalescing neighbouring reads into
+     * single preadv() calls.  Overlapping reads are performed individually.
+     * @param reads Reads to perform.  Sorted in place by file offset.
+     * @throws memread
+     */
+    void preadv_coalesced(std::vector<FileRead> & reads) const;
+
+    /**
+     * Read bytes from an unmapped memory region via the page cache.
+     * Frames which lie entirely within the region are read and cached
+     * whole.  Partial frames at unaligned region edges are read directly.
+     * @param region Memory region containing addr.
+     * @param addr Machine address to read from.
+     * @param dst Destination buffer.
+     * @param n Number of bytes to read.  Must not exceed the end of region.
+     * @throws memread
+     */
+    void read_region_cached(const MemRegion & region, const maddr_t & addr,
+                            char * dst, ssize_t n) const;
+
+    /**
+     * Satisfy a read from a zero region.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     */
+    void zero_fill(char * dst, ssize_t n) const;
+
+    /**
+     * Record the frames covered by a read, if recording.
+     * @param addr Machine address of the read.
+     * @param n Length of the read.
+     */
+    void touch(const maddr_t & addr, ssize_t n) const;
+
+    /**
+     * Read bytes from a compressed crash file via the page cache.
+     * @param region Memory region containing addr.
+     * @param addr Machine address to read from.
+     * @param dst Destination buffer.
+     * @param n Number of bytes to read.  Must not exceed the end of its region.
+     * @throws memseek
+     * @throws memread
+     */
+    void read_compressed(const MemRegion & region, const maddr_t & addr,
+                         char * dst, ssize_t n) const;
+
+    /// Vector of memory regions, sorted by start address.
     std::vector<MemRegion> regions;
+    /// Index of the region which satisfied the most recent lookup.
+    mutable size_t last_region;
     /// Whether the vector is finalised or not.
     bool finalised;
-    /// Core File reference
-    int fd;
+    /// A CORE file of the set.
+    struct CoreFile
+    {
+        /// File descriptor.
+        int fd;
+        /// File descriptor opened with O_DIRECT, or -1.
+        int direct_fd;
+        /// Elf parser, which supplies compressed frames.
+        const Abstract::Elf * elf;
+    };
+
+    /// CORE files, indexed by MemRegion::file.
+    std::vector<CoreFile> files;
+    /// Whether frames are read through the parsers' read_page().
+    bool compressed;
+    /// Whether files are read with O_DIRECT.
+    bool direct;
+    /// Cache of frames read via fd.
+    mutable PageCache cache;
+    /**
+     * Whether copy_file_range() might work from fd.  Cleared by any
+     * thread, so only accessed with __sync builtins once setup() returns.
+     */
+    mutable int can_copy_range;
+    /// Whether sendfile() might work from fd.  As can_copy_range.
+    mutable int can_sendfile;
+    /// Requested asynchronous read queue depth.
+    unsigned async_depth;
+    /// Asynchronous read engine, or NULL for synchronous reads.
+    AsyncIO * async;
+    /// Bytes read from zero regions by all threads.
+    mutable uint64_t nr_zero_fill;
+    /// Whether touch() records frames.
+    bool recording;
+    /// Frames read since record_frames().
+    mutable std::set<uint64_t> touched;
+    /// Lock protecting touched.
+    mutable pthread_mutex_t touched_lock;
+
+private:
+    // @cond EXCLUDE
+    Memory(const Memory &);
+    Memory & operator= (const Memory &);
+    // @endcond
 };
 
 /// Memory
@@ -0,0 +1,138 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __PAGE_CACHE_HPP__
+#define __PAGE_CACHE_HPP__
+
+/**
+ * @file include/page-cache.hpp
+ */
+
+#include "types.hpp"
+
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+/**
+ * Page cache.
+ * A bounded cache of 4K frames, keyed on frame number and evicted with the
+ * CLOCK algorithm.  Slots are allocated lazily, so the configured budget is
+ * an upper bound rather than an up-front cost, which matters in the kdump
+ * environment.  All operations take an internal lock, so a single cache may
+ * be shared between threads.
+ */
+class PageCache
+{
+public:
+    /// Constructor.
+    PageCache();
+    /// Destructor.
+    ~PageCache();
+
+    /**
+     * Set the byte budget of the cache, discarding any cached frames.
+     * @param bytes Maximum bytes of frame data to cache.  0 disables the cache.
+     */
+    void set_budget(size_t bytes);
+
+    /// Whether the cache has a non-zero budget.
+    bool enabled() const { return this->max_slots != 0; }
+
+    /**
+     * Copy part of a cached frame out of the cache.
+     * @param frame Frame number.
+     * @param offset Offset into the frame.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.  offset + n must not exceed PAGE_SIZE.
+     * @returns boolean indicating a cache hit.
+     */
+    bool lookup(uint64_t frame, size_t offset, char * dst, size_t n);
+
+    /**
+     * Insert a frame into the cache, evicting another if necessary.  Running
+     * out of memory just leaves the frame uncached.
+     * @param frame Frame number.
+     * @param data PAGE_SIZE bytes of frame data.
+     */
+    void insert(uint64_t frame, const char * data);
+
+    /// Drop all cached frames, keeping the budget.
+    void flush();
+
+    /// Number of lookups satisfied from the cache.
+    uint64_t nr_hits() const { return this->hits; }
+    /// Number of lookups not satisfied from the cache.
+    uint64_t nr_misses() const { return this->misses; }
+    /// Number of frames evicted to make space.
+    uint64_t nr_evictions() const { return this->evictions; }
+
+protected:
+    /// Cache slot.
+    struct Slot
+    {
+        /// Frame number held in this slot.
+        uint64_t frame;
+        /// Frame data.
+        char * data;
+        /// CLOCK reference bit.
+        bool referenced;
+    };
+
+    /// Free all slots.  Caller must hold the lock.
+    void free_slots();
+
+    /// Slots, grown on demand up to max_slots.
+    std::vector<Slot> slots;
+    /// Frame number to slot index.
+    std::map<uint64_t, size_t> index;
+    /// Maximum number of slots.
+    size_t max_slots;
+    /// CLOCK hand.
+    size_t hand;
+
+    /// Hit counter.
+    uint64_t hits;
+    /// Miss counter.
+    uint64_t misses;
+    /// Eviction counter.
+    uint64_t evictions;
+
+    /// Lock protecting the cache state.
+    pthread_mutex_t lock;
+
+private:
+    // @cond EXCLUDE
+    PageCache(const PageCache &);
+    PageCache & operator= (const PageCache &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
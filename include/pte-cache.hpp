@@ -0,0 +1,149 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __PTE_CACHE_HPP__
+#define __PTE_CACHE_HPP__
+
+/**
+ * @file include/pte-cache.hpp
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+
+/**
+ * Paging-structure cache.
+ * Caches upper-level pagetable entries, keyed on the machine address of the
+ * entry, and shared between all pagetables.  Xen's own mappings appear in
+ * every PML4, and the VCPUs of a domain share most of their upper levels, so
+ * the first walk of a new cr3 mostly hits here rather than in the crash
+ * file.  Leaf entries are not cached, as there are far more of them.
+ *
+ * The cache is direct-mapped.  Entries are allocated on first insert and
+ * charged to the memory budget; if the budget refuses, every lookup misses.
+ *
+ * Not thread safe.  Pagetables are only walked from the main thread.
+ */
+class PTECache
+{
+public:
+    /// Constructor.
+    PTECache();
+    /// Destructor.
+    ~PTECache();
+
+    /**
+     * Look up a pagetable entry.
+     * @param addr Machine address of the entry.
+     * @param entry Variable for the entry.
+     * @returns boolean indicating a hit.
+     */
+    bool lookup(const maddr_t & addr, uint64_t & entry)
+    {
+        if ( this->entries )
+        {
+            const Slot & s = this->entries[PTECache::index(addr)];
+
+            if ( s.addr == addr )
+            {
+                entry = s.entry;
+                ++this->hits;
+                return true;
+            }
+        }
+
+        ++this->misses;
+        return false;
+    }
+
+    /**
+     * Insert a pagetable entry.
+     * @param addr Machine address of the entry.
+     * @param entry Entry read from addr.
+     */
+    void insert(const maddr_t & addr, const uint64_t & entry);
+
+    /// Discard all entries.
+    void flush();
+
+    /// Log statistics, if the cache has been used.
+    void log() const;
+
+    /// Number of lookups satisfied from the cache.
+    uint64_t nr_hits() const { return this->hits; }
+    /// Number of lookups not satisfied from the cache.
+    uint64_t nr_misses() const { return this->misses; }
+
+protected:
+    /// Cache slot.
+    struct Slot
+    {
+        /// Machine address of the entry, or ~0 if unused.
+        maddr_t addr;
+        /// Pagetable entry.
+        uint64_t entry;
+    };
+
+    /**
+     * Slot index for an entry address.
+     * @param addr Machine address of the entry.
+     * @returns index.
+     */
+    static size_t index(const maddr_t & addr)
+    {
+        // Mix in the frame number, so entry 0 of every table doesn't collide.
+        return ( (addr >> 3) ^ (addr >> 12) ) & (PTECACHE_SLOTS - 1);
+    }
+
+    /// Number of slots.  Must be a power of two.
+    static const size_t PTECACHE_SLOTS = 2048;
+
+    /// Slots, or NULL if not yet allocated.
+    Slot * entries;
+    /// Whether the memory budget refused the slots.
+    bool refused;
+
+    /// Hit counter.
+    uint64_t hits;
+    /// Miss counter.
+    uint64_t misses;
+
+private:
+    // @cond EXCLUDE
+    PTECache(const PTECache &);
+    PTECache & operator= (const PTECache &);
+    // @endcond
+};
+
+/// Paging-structure cache
+extern PTECache ptecache;
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
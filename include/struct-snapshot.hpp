@@ -0,0 +1,115 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#ifndef __STRUCT_SNAPSHOT_HPP__
+#define __STRUCT_SNAPSHOT_HPP__
+
+/**
+ * @file include/struct-snapshot.hpp
+ */
+
+#include "types.hpp"
+#include "abstract/pagetable.hpp"
+
+#include <vector>
+
+/**
+ * Snapshot of a Xen structure.
+ * Reads a whole structure (e.g. DOMAIN_sizeof bytes of struct domain) with
+ * one translated block read, after which fields are extracted by xensym
+ * offset without further pagetable walks or core file reads.
+ */
+class StructSnapshot
+{
+public:
+    /// Constructor.
+    StructSnapshot();
+
+    /**
+     * Read a structure.
+     * @param pt PageTable to perform the pagetable walk with.
+     * @param addr Virtual address of the structure.
+     * @param size Size of the structure.
+     * @throws validate if size is implausible.
+     * @throws pagefault
+     * @throws memseek
+     * @throws memread
+     */
+    void read(const Abstract::PageTable & pt, const vaddr_t & addr, const vaddr_t & size);
+
+    /**
+     * Get a block of bytes from the snapshot.
+     * @param offset Offset into the structure.
+     * @param dst Destination buffer.
+     * @param n Length of buffer.
+     * @throws validate if the field lies outside of the structure.
+     */
+    void get(const vaddr_t & offset, char * dst, size_t n) const;
+
+    /**
+     * Get an 8 bit integer from the snapshot.
+     * @param offset Offset into the structure.
+     * @param dst Destination integer.
+     * @throws validate if the field lies outside of the structure.
+     */
+    void get(const vaddr_t & offset, uint8_t & dst) const;
+
+    /**
+     * Get a 16 bit integer from the snapshot.
+     * @param offset Offset into the structure.
+     * @param dst Destination integer.
+     * @throws validate if the field lies outside of the structure.
+     */
+    void get(const vaddr_t & offset, uint16_t & dst) const;
+
+    /**
+     * Get a 32 bit integer from the snapshot.
+     * @param offset Offset into the structure.
+     * @param dst Destination integer.
+     * @throws validate if the field lies outside of the structure.
+     */
+    void get(const vaddr_t & offset, uint32_t & dst) const;
+
+    /**
+     * Get a 64 bit integer from the snapshot.
+     * @param offset Offset into the structure.
+     * @param dst Destination integer.
+     * @throws validate if the field lies outside of the structure.
+     */
+    void get(const vaddr_t & offset, uint64_t & dst) const;
+
+protected:
+    /// Virtual address of the structure, for error reporting.
+    vaddr_t addr;
+    /// Structure contents.
+    std::vector<char> data;
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -37,6 +37,15 @@
  */
 bool is_zeroes(const char * buffer, const size_t size);
 
+/**
+ * Parse a size from a string, with an optional K, M or G suffix.
+ *
+ * @param str String to parse.
+ * @param size Parsed size in bytes.
+ * @return boolean indicating whether str was a valid size.
+ */
+bool parse_size(const char * str, size_t & size);
+
 #endif
 
 /*
@@ -25,6 +25,8 @@
 
 #include "abstract/elf.hpp"
 #include "arch/x86_64/elf.hpp"
+#include "arch/x86_64/diskdump.hpp"
+#include "exceptions.hpp"
 
 #include "util/log.hpp"
 #include "util/macros.hpp"
@@ -34,6 +36,8 @@
 #include <errno.h>
 #include <elf.h>
 
+#include "Xen.h"
+
 namespace Abstract
 {
 
@@ -58,6 +62,16 @@ namespace Abstract
         SAFE_DELETE_ARRAY(this->phdrs);
     }
 
+    bool Elf::compressed() const
+    {
+        return false;
+    }
+
+    void Elf::read_page(const uint64_t & pfn, char *) const
+    {
+        throw memseek(pfn << PAGE_SHIFT, 0);
+    }
+
     Elf * Elf::create(const char * path)
     {
         int fd;
@@ -83,6 +97,11 @@ namespace Abstract
             goto error_close;
         }
 
+        if ( 0 == std::memcmp(KDUMP_SIGNATURE, ident, KDUMP_SIG_LEN) )
+        {
+            return new x86_64::DiskDump(fd);
+        }
+
         if ( 0 != std::strncmp(ELFMAG, ident, SELFMAG) )
         {
             LOG_ERROR("File is not an elf file\n");
@@ -119,6 +138,51 @@ namespace Abstract
         return NULL;
     }
 
+    bool Elf::create_set(const std::vector<const char *> & paths,
+                         std::vector<Elf *> & elfs)
+    {
+        for ( std::vector<const char *>::const_iterator it = paths.begin();
+              it != paths.end(); ++it )
+        {
+            Elf * elf = Elf::create(*it);
+
+            if ( ! elf )
+            {
+                LOG_ERROR("Failed to open crash file %s\n", *it);
+                goto error;
+            }
+
+            elfs.push_back(elf);
+
+            if ( ! elf->parse() )
+            {
+                LOG_ERROR("Failed to parse crash file %s\n", *it);
+                goto error;
+            }
+
+            if ( elf->nr_cpus != elfs[0]->nr_cpus )
+            {
+                LOG_ERROR("Crash file %s has notes for %d cpus, but %s has %d\n",
+                          *it, elf->nr_cpus, paths[0], elfs[0]->nr_cpus);
+                goto error;
+            }
+        }
+
+        return true;
+
+    error:
+        Elf::delete_set(elfs);
+        return false;
+    }
+
+    void Elf::delete_set(std::vector<Elf *> & elfs)
+    {
+        for ( std::vector<Elf *>::iterator it = elfs.begin();
+              it != elfs.end(); ++it )
+            SAFE_DELETE(*it);
+        elfs.clear();
+    }
+
 }
 
 /*
@@ -0,0 +1,157 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+/**
+ * @file src/abstract/pagetable.cpp
+ */
+
+#include "abstract/pagetable.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+
+namespace Abstract
+{
+    /// Orders indices into an array of translations by virtual address.
+    class TranslationOrder
+    {
+    public:
+        /**
+         * Constructor.
+         * @param translations Array of translations.
+         */
+        TranslationOrder(const PageTable::Translation * translations):
+            translations(translations)
+        {}
+
+        /// Comparison.
+        bool operator() (size_t a, size_t b) const
+        {
+            return this->translations[a].vaddr < this->translations[b].vaddr;
+        }
+
+    private:
+        /// Array of translations.
+        const PageTable::Translation * translations;
+    };
+
+    PageTable::WalkStatus PageTable::try_walk(const vaddr_t & vaddr,
+                                              maddr_t & maddr,
+                                              vaddr_t * page_end,
+                                              int * level) const
+    {
+        try
+        {
+            this->walk(vaddr, maddr, page_end);
+            return WALK_OK;
+        }
+        catch ( const pagefault & e )
+        {
+            if ( e.reason != pagefault::FAULT_NOTPRESENT )
+                throw;
+
+            // Only the faulting page is known to be absent.
+            if ( page_end )
+                *page_end = vaddr | ((1ULL << 12) - 1);
+            if ( level )
+                *level = e.level;
+            return WALK_NOTPRESENT;
+        }
+    }
+
+    void PageTable::walk_many(Translation * translations, size_t nr) const
+    {
+        std::vector<size_t> order(nr);
+        vaddr_t start = 0, end = 0;
+        maddr_t base = 0;
+        WalkStatus status = WALK_OK;
+        int level = 0;
+        bool have_range = false;
+
+        for ( size_t x = 0; x < nr; ++x )
+            order[x] = x;
+        std::sort(order.begin(), order.end(), TranslationOrder(translations));
+
+        for ( size_t x = 0; x < nr; ++x )
+        {
+            Translation & t = translations[order[x]];
+
+            // Outside the last page or not present range walked?
+            if ( ! have_range || t.vaddr < start || t.vaddr > end )
+            {
+                level = 0;
+                start = t.vaddr;
+                have_range = true;
+
+                try
+                {
+                    status = this->try_walk(t.vaddr, base, &end, &level);
+                }
+                catch ( const CommonError & )
+                {
+                    status = WALK_ERROR;
+                    end = t.vaddr;
+                }
+            }
+
+            t.status = status;
+            t.level = level;
+            t.maddr = status == WALK_OK ? base + (t.vaddr - start) : 0;
+        }
+    }
+
+    void PageTable::translate_range(const vaddr_t & vaddr, uint64_t len,
+                                    std::vector<Extent> & extents) const
+    {
+        vaddr_t addr = vaddr, end;
+        maddr_t maddr;
+
+        extents.clear();
+
+        while ( len )
+        {
+            this->walk(addr, maddr, &end);
+
+            uint64_t nr = std::min(len, end - addr + 1);
+
+            if ( ! extents.empty() &&
+                 extents.back().maddr + extents.back().len == maddr )
+                extents.back().len += nr;
+            else
+            {
+                Extent e = { maddr, nr };
+                extents.push_back(e);
+            }
+
+            addr += nr;
+            len -= nr;
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -37,10 +37,12 @@ namespace Abstract
 {
     void Payload::decode_common()
     {
-        memory.read32_vaddr(xenpt, payload_addr + LIVEPATCH_payload_state,
-                            state);
-        memory.read32_vaddr(xenpt, payload_addr + LIVEPATCH_payload_rc,
-                            (uint32_t &)rc);
+        ReadBatch batch;
+
+        batch.add(payload_addr + LIVEPATCH_payload_state, state);
+        batch.add(payload_addr + LIVEPATCH_payload_rc, (uint32_t &)rc);
+        memory.read_batch_vaddr(xenpt, batch);
+
         name = new char[LIVEPATCH_payload_name_max_len];
         memory.read_str_vaddr(xenpt, payload_addr + LIVEPATCH_payload_name,
                               name, LIVEPATCH_payload_name_max_len);
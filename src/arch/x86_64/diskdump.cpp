@@ -0,0 +1,576 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/diskdump.cpp
+ */
+
+#include "arch/x86_64/diskdump.hpp"
+
+#include "util/log.hpp"
+#include "util/macros.hpp"
+#include "exceptions.hpp"
+#include "mem-budget.hpp"
+#include "types.hpp"
+#include "Xen.h"
+
+/// @cond EXCLUDE
+#ifndef _LARGEFILE64_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+/// @endcond
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <new>
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZO
+#include <lzo/lzo1x.h>
+#endif
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// Page descriptor flag: zlib compressed.
+#define DUMP_DH_COMPRESSED_ZLIB 0x1
+/// Page descriptor flag: lzo compressed.
+#define DUMP_DH_COMPRESSED_LZO 0x2
+/// Page descriptor flag: snappy compressed.
+#define DUMP_DH_COMPRESSED_SNAPPY 0x4
+/// Header status flag: makedumpfile didn't finish writing the file.
+#define DUMP_DH_COMPRESSED_INCOMPLETE 0x8
+/// Page descriptor flag: zstd compressed.
+#define DUMP_DH_COMPRESSED_ZSTD 0x20
+
+/// Dump level bit: zero frames excluded.
+#define DL_EXCLUDE_ZERO 0x1
+
+/// Number of bitmap words covered by each precomputed rank.
+static const uint64_t RANK_WORDS = 8;
+
+/// makedumpfile's struct disk_dump_header, as written by a 64bit host.
+struct DiskDumpHeader
+{
+    /// KDUMP_SIGNATURE.
+    char signature[KDUMP_SIG_LEN];
+    /// Header version.
+    int32_t header_version;
+    /// struct new_utsname of the crashed kernel.
+    char utsname[6 * 65];
+    /// Padding to the alignment of timestamp.
+    char pad[6];
+    /// struct timeval of the crash.
+    uint64_t tv_sec, tv_usec;
+    /// Status flags.
+    uint32_t status;
+    /// Block size.  All offsets in the header are in blocks.
+    int32_t block_size;
+    /// Size of the sub header, in blocks.
+    int32_t sub_hdr_size;
+    /// Size of both bitmaps, in blocks.
+    uint32_t bitmap_blocks;
+    /// Number of frames, if it fits in 32 bits.
+    uint32_t max_mapnr;
+    /// Unused.
+    uint32_t total_ram_blocks, device_blocks, written_blocks;
+    /// Cpu which crashed.
+    uint32_t current_cpu;
+    /// Number of cpus.
+    int32_t nr_cpus;
+};
+
+/// makedumpfile's struct kdump_sub_header, as written by a 64bit host.
+struct KdumpSubHeader
+{
+    /// Physical base of the kernel.
+    uint64_t phys_base;
+    /// Dump level.
+    int32_t dump_level;
+    /// Whether this file is one of a split set.
+    int32_t split;
+    /// Range of frames in this file of a split set.
+    uint64_t start_pfn, end_pfn;
+    /// Location of the vmcoreinfo (header version 3 or later).
+    uint64_t offset_vmcoreinfo, size_vmcoreinfo;
+    /// Location of the elf notes (header version 4 or later).
+    uint64_t offset_note, size_note;
+    /// Location of the erase information (header version 5 or later).
+    uint64_t offset_eraseinfo, size_eraseinfo;
+    /// 64bit range of frames (header version 6 or later).
+    uint64_t start_pfn_64, end_pfn_64;
+    /// 64bit number of frames (header version 6 or later).
+    uint64_t max_mapnr_64;
+};
+
+/// makedumpfile's struct page_desc.
+struct PageDesc
+{
+    /// File offset of the page data.
+    int64_t offset;
+    /// Size of the page data.
+    uint32_t size;
+    /// Compression flags.
+    uint32_t flags;
+    /// Unused.
+    uint64_t page_flags;
+};
+
+namespace x86_64
+{
+
+    DiskDump::DiskDump(int fd):
+        Elf(fd), block_size(0), max_mapnr(0), start_pfn(0), end_pfn(0),
+        desc_base(0), desc_offset(0), zero_offset(0),
+        bitmap(), rank(), budget_charge(0)
+    {
+#ifdef HAVE_LZO
+        if ( LZO_E_OK != lzo_init() )
+            LOG_WARN("lzo_init() failed\n");
+#endif
+    }
+
+    DiskDump::~DiskDump()
+    {
+        membudget.uncharge(this->budget_charge);
+    }
+
+    bool DiskDump::compressed() const
+    {
+        return true;
+    }
+
+    bool DiskDump::parse()
+    {
+        DiskDumpHeader hdr;
+        KdumpSubHeader sub;
+        ssize_t r;
+
+        if ( (r = this->pread_full(0, &hdr, sizeof hdr)) != sizeof hdr )
+        {
+            LOG_ERROR("  Failed to read diskdump header: %s\n",
+                      r == -1 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        LOG_DEBUG("  Diskdump header version %"PRId32", block size %"PRId32
+                  ", %"PRIu32" bitmap blocks\n", hdr.header_version,
+                  hdr.block_size, hdr.bitmap_blocks);
+
+        if ( hdr.block_size != (int32_t)PAGE_SIZE )
+        {
+            LOG_ERROR("  Unsupported diskdump block size %"PRId32"\n", hdr.block_size);
+            return false;
+        }
+        this->block_size = hdr.block_size;
+
+        // The elf notes were only included from version 4.
+        if ( hdr.header_version < 4 )
+        {
+            LOG_ERROR("  Diskdump header version %"PRId32" has no elf notes\n",
+                      hdr.header_version);
+            return false;
+        }
+
+        if ( hdr.status & DUMP_DH_COMPRESSED_INCOMPLETE )
+            LOG_WARN("  Diskdump file is incomplete.  Some frames may be missing\n");
+
+        if ( (r = this->pread_full(this->block_size, &sub, sizeof sub)) != sizeof sub )
+        {
+            LOG_ERROR("  Failed to read diskdump sub header: %s\n",
+                      r == -1 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        this->max_mapnr = hdr.header_version >= 6 ? sub.max_mapnr_64 : hdr.max_mapnr;
+
+        uint64_t bitmap_offset = (uint64_t)(1 + hdr.sub_hdr_size) * this->block_size;
+        uint64_t bitmap_len = (uint64_t)hdr.bitmap_blocks * this->block_size;
+
+        // The second half of the bitmap area holds the dumped frames.
+        if ( this->max_mapnr > (bitmap_len / 2) * 8 )
+        {
+            LOG_WARN("  %"PRIu64" frames don't fit in the diskdump bitmap.  Truncating\n",
+                     this->max_mapnr);
+            this->max_mapnr = (bitmap_len / 2) * 8;
+        }
+
+        this->desc_offset = bitmap_offset + bitmap_len;
+
+        if ( ! this->parse_bitmap(bitmap_offset + bitmap_len / 2) )
+            return false;
+
+        this->end_pfn = this->max_mapnr;
+        if ( sub.split )
+        {
+            this->start_pfn = hdr.header_version >= 6 ? sub.start_pfn_64 : sub.start_pfn;
+            this->end_pfn = std::min(this->max_mapnr, hdr.header_version >= 6 ?
+                                     sub.end_pfn_64 : sub.end_pfn);
+
+            if ( this->start_pfn >= this->end_pfn )
+            {
+                LOG_ERROR("  Empty range of frames in split diskdump file\n");
+                return false;
+            }
+
+            this->desc_base = this->desc_index(this->start_pfn);
+            LOG_INFO("  Split diskdump file holding frames %#"PRIx64" to %#"PRIx64"\n",
+                     this->start_pfn, this->end_pfn - 1);
+        }
+
+        if ( ! ( sub.dump_level & DL_EXCLUDE_ZERO ) )
+            this->find_zero_page();
+
+        if ( ! this->build_phdrs(sub.offset_note, sub.size_note) )
+            return false;
+
+        return this->parse_nhdrs(this->phdrs[0]);
+    }
+
+    bool DiskDump::parse_bitmap(uint64_t offset)
+    {
+        uint64_t nr_words = (this->max_mapnr + 63) / 64;
+        uint64_t nr_ranks = (nr_words + RANK_WORDS - 1) / RANK_WORDS;
+
+        this->budget_charge = (nr_words + nr_ranks) * sizeof(uint64_t);
+        membudget.charge_required(this->budget_charge);
+
+        if ( ! this->read_bitmap(offset, this->bitmap) )
+            return false;
+
+        try
+        {
+            this->rank.resize(nr_ranks);
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            return false;
+        }
+
+        uint64_t count = 0;
+        for ( uint64_t w = 0; w < nr_words; ++w )
+        {
+            if ( w % RANK_WORDS == 0 )
+                this->rank[w / RANK_WORDS] = count;
+            count += __builtin_popcountll(this->bitmap[w]);
+        }
+
+        LOG_DEBUG("  %"PRIu64" of %"PRIu64" frames dumped\n", count, this->max_mapnr);
+        return true;
+    }
+
+    bool DiskDump::read_bitmap(uint64_t offset, std::vector<uint64_t> & words) const
+    {
+        uint64_t nr_words = (this->max_mapnr + 63) / 64;
+        ssize_t r;
+
+        if ( nr_words * sizeof(uint64_t) != (size_t)(nr_words * sizeof(uint64_t)) )
+        {
+            LOG_ERROR("  Diskdump bitmap too large for address space\n");
+            return false;
+        }
+
+        try
+        {
+            words.resize(nr_words);
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            return false;
+        }
+
+        if ( nr_words &&
+             (r = this->pread_full(offset, &words[0], nr_words * sizeof(uint64_t)))
+             != (ssize_t)(nr_words * sizeof(uint64_t)) )
+        {
+            LOG_ERROR("  Failed to read diskdump bitmap: %s\n",
+                      r == -1 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        // Ignore any bits past the final frame.
+        if ( this->max_mapnr & 63 )
+            words[nr_words - 1] &= (1ULL << (this->max_mapnr & 63)) - 1;
+
+        return true;
+    }
+
+    void DiskDump::find_zero_page()
+    {
+        uint64_t nr_desc, offset;
+        char data[PAGE_SIZE];
+
+        /* Zero pages which weren't excluded all share one descriptor,
+         * pd_zero, whose data is written first, straight after the page
+         * descriptor table. */
+        if ( this->end_pfn <= this->start_pfn )
+            return;
+
+        nr_desc = this->desc_index(this->end_pfn - 1) - this->desc_base +
+            ( this->is_dumped(this->end_pfn - 1) ? 1 : 0 );
+        offset = this->desc_offset + nr_desc * sizeof (PageDesc);
+
+        if ( this->pread_full(offset, data, sizeof data) != (ssize_t)sizeof data )
+            return;
+
+        for ( size_t x = 0; x < sizeof data; ++x )
+            if ( data[x] )
+                return;
+
+        this->zero_offset = offset;
+        LOG_DEBUG("  Shared zero page at file offset %#"PRIx64"\n", offset);
+    }
+
+    bool DiskDump::build_phdrs(uint64_t note_offset, uint64_t note_size)
+    {
+        int nr_runs = 0;
+        bool in_run = false;
+
+        for ( uint64_t pfn = this->start_pfn; pfn < this->end_pfn; ++pfn )
+        {
+            bool dumped = this->is_dumped(pfn);
+            if ( dumped && ! in_run )
+                ++nr_runs;
+            in_run = dumped;
+        }
+
+        if ( nr_runs < 1 )
+        {
+            LOG_ERROR("  No frames present in diskdump file\n");
+            return false;
+        }
+
+        this->nr_phdrs = nr_runs + 1;
+        try
+        {
+            this->phdrs = new ElfProgHdr[this->nr_phdrs];
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            return false;
+        }
+
+        this->phdrs[0].type = PT_NOTE;
+        this->phdrs[0].offset = note_offset;
+        this->phdrs[0].phys = 0;
+        this->phdrs[0].size = this->phdrs[0].memsz = note_size;
+
+        // Offsets are meaningless for compressed frames.
+        int x = 0;
+        in_run = false;
+        for ( uint64_t pfn = this->start_pfn; pfn < this->end_pfn; ++pfn )
+        {
+            bool dumped = this->is_dumped(pfn);
+            if ( dumped && ! in_run )
+            {
+                ++x;
+                this->phdrs[x].type = PT_LOAD;
+                this->phdrs[x].offset = 0;
+                this->phdrs[x].phys = pfn << PAGE_SHIFT;
+                this->phdrs[x].size = this->phdrs[x].memsz = 0;
+            }
+            if ( dumped )
+                this->phdrs[x].size = this->phdrs[x].memsz += PAGE_SIZE;
+            in_run = dumped;
+        }
+
+        LOG_DEBUG("  Found %d runs of dumped frames\n", nr_runs);
+        return true;
+    }
+
+    bool DiskDump::is_dumped(const uint64_t & pfn) const
+    {
+        return pfn >= this->start_pfn && pfn < this->end_pfn &&
+            ( this->bitmap[pfn / 64] & (1ULL << (pfn & 63)) );
+    }
+
+    uint64_t DiskDump::desc_index(const uint64_t & pfn) const
+    {
+        uint64_t word = pfn / 64;
+        uint64_t index = this->rank[word / RANK_WORDS];
+
+        for ( uint64_t w = word - word % RANK_WORDS; w < word; ++w )
+            index += __builtin_popcountll(this->bitmap[w]);
+
+        return index + __builtin_popcountll(this->bitmap[word] &
+                                            ((1ULL << (pfn & 63)) - 1));
+    }
+
+    void DiskDump::read_page(const uint64_t & pfn, char * dst) const
+    {
+        static bool warn_once = true;
+        maddr_t addr = pfn << PAGE_SHIFT;
+        char data[PAGE_SIZE];
+        PageDesc pd;
+        ssize_t r;
+
+        if ( ! this->is_dumped(pfn) )
+            throw memseek(addr, 0);
+
+        r = this->pread_full(this->desc_offset +
+                             ( this->desc_index(pfn) - this->desc_base ) * sizeof pd,
+                             &pd, sizeof pd);
+        if ( r != sizeof pd )
+            throw memread(addr, r, sizeof pd, r == -1 ? errno : 0);
+
+        if ( pd.offset <= 0 || pd.size > this->block_size )
+            throw memread(addr, 0, PAGE_SIZE, EINVAL);
+
+        // A zero page recorded by makedumpfile needs no read.
+        if ( this->zero_offset && (uint64_t)pd.offset == this->zero_offset &&
+             pd.size == this->block_size && pd.flags == 0 )
+        {
+            memset(dst, 0, PAGE_SIZE);
+            return;
+        }
+
+        // Uncompressed frames are read straight into place.
+        if ( ! ( pd.flags & ( DUMP_DH_COMPRESSED_ZLIB | DUMP_DH_COMPRESSED_LZO |
+                              DUMP_DH_COMPRESSED_SNAPPY | DUMP_DH_COMPRESSED_ZSTD ) ) )
+        {
+            if ( pd.size != this->block_size )
+                throw memread(addr, 0, PAGE_SIZE, EINVAL);
+
+            r = this->pread_full(pd.offset, dst, PAGE_SIZE);
+            if ( r != (ssize_t)PAGE_SIZE )
+                throw memread(addr, r, PAGE_SIZE, r == -1 ? errno : 0);
+            return;
+        }
+
+        r = this->pread_full(pd.offset, data, pd.size);
+        if ( r != (ssize_t)pd.size )
+            throw memread(addr, r, pd.size, r == -1 ? errno : 0);
+
+        bool ok = false, supported = true;
+
+        switch ( pd.flags & ( DUMP_DH_COMPRESSED_ZLIB | DUMP_DH_COMPRESSED_LZO |
+                              DUMP_DH_COMPRESSED_SNAPPY | DUMP_DH_COMPRESSED_ZSTD ) )
+        {
+        case DUMP_DH_COMPRESSED_ZLIB:
+        {
+#ifdef HAVE_ZLIB
+            uLongf len = PAGE_SIZE;
+            ok = Z_OK == uncompress((Bytef *)dst, &len, (const Bytef *)data, pd.size) &&
+                len == PAGE_SIZE;
+#else
+            supported = false;
+#endif
+            break;
+        }
+
+        case DUMP_DH_COMPRESSED_LZO:
+        {
+#ifdef HAVE_LZO
+            lzo_uint len = PAGE_SIZE;
+            ok = LZO_E_OK == lzo1x_decompress_safe((const unsigned char *)data, pd.size,
+                                                   (unsigned char *)dst, &len, NULL) &&
+                len == PAGE_SIZE;
+#else
+            supported = false;
+#endif
+            break;
+        }
+
+        case DUMP_DH_COMPRESSED_SNAPPY:
+        {
+#ifdef HAVE_SNAPPY
+            size_t len;
+            ok = SNAPPY_OK == snappy_uncompressed_length(data, pd.size, &len) &&
+                len == PAGE_SIZE &&
+                SNAPPY_OK == snappy_uncompress(data, pd.size, dst, &len);
+#else
+            supported = false;
+#endif
+            break;
+        }
+
+        case DUMP_DH_COMPRESSED_ZSTD:
+        {
+#ifdef HAVE_ZSTD
+            size_t len = ZSTD_decompress(dst, PAGE_SIZE, data, pd.size);
+            ok = ! ZSTD_isError(len) && len == PAGE_SIZE;
+#else
+            supported = false;
+#endif
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        if ( ! supported )
+        {
+            if ( warn_once )
+            {
+                warn_once = false;
+                LOG_ERROR("Crash file uses a compression method (flags %#"PRIx32
+                          ") this build doesn't support\n", pd.flags);
+            }
+            throw memread(addr, 0, PAGE_SIZE, ENOTSUP);
+        }
+
+        if ( ! ok )
+            throw memread(addr, 0, PAGE_SIZE, EILSEQ);
+    }
+
+    ssize_t DiskDump::pread_full(uint64_t offset, void * dst, size_t n) const
+    {
+        size_t total = 0;
+
+        while ( total < n )
+        {
+            ssize_t r = pread64(this->fd, (char *)dst + total, n - total,
+                                (off64_t)(offset + total));
+            if ( r < 0 )
+            {
+                if ( errno == EINTR )
+                    continue;
+                return -1;
+            }
+            if ( r == 0 )
+                break;
+            total += r;
+        }
+
+        return (ssize_t)total;
+    }
+
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -21,8 +21,11 @@
 #include "arch/x86_64/domain.hpp"
 #include "arch/x86_64/vcpu.hpp"
 #include "arch/x86_64/xensyms.hpp"
+#include "arch/x86_64/pagetable.hpp"
 #include "abstract/xensyms.hpp"
 #include "memory.hpp"
+#include "mem-budget.hpp"
+#include "struct-snapshot.hpp"
 #include "host.hpp"
 #include "util/print-structures.hpp"
 #include "util/print-bitwise.hpp"
@@ -43,7 +46,7 @@ namespace x86_64
 {
 
     Domain::Domain(const Abstract::PageTable & xenpt)
-        : Abstract::Domain(xenpt)
+        : Abstract::Domain(xenpt), budget_charge(0)
     {
         memset(this->handle, 0, sizeof this->handle);
     }
@@ -58,6 +61,7 @@ namespace x86_64
             delete [] this->vcpus;
             this->vcpus = NULL;
         }
+        membudget.uncharge(this->budget_charge);
     }
 
     bool Domain::parse_basic(const vaddr_t & domain_ptr)
@@ -71,26 +75,28 @@ namespace x86_64
             host.validate_xen_vaddr(domain_ptr);
             this->domain_ptr = domain_ptr;
 
-            memory.read16_vaddr(this->xenpt, this->domain_ptr + DOMAIN_id, this->domain_id);
+            StructSnapshot dom;
+            dom.read(this->xenpt, this->domain_ptr, DOMAIN_sizeof);
 
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_32bit_pv, this->is_32bit_pv);
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_hvm, this->is_hvm);
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_privileged, this->is_privileged);
+            dom.get(DOMAIN_id, this->domain_id);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_max_vcpus, this->max_cpus);
-            memory.read64_vaddr(this->xenpt, this->domain_ptr + DOMAIN_vcpus, this->vcpus_ptr);
+            dom.get(DOMAIN_is_32bit_pv, this->is_32bit_pv);
+            dom.get(DOMAIN_is_hvm, this->is_hvm);
+            dom.get(DOMAIN_is_privileged, this->is_privileged);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_paging_mode, this->paging_mode);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_tot_pages, this->tot_pages);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_max_pages, this->max_pages);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_shr_pages, (uint32_t&)this->shr_pages);
+            dom.get(DOMAIN_max_vcpus, this->max_cpus);
+            dom.get(DOMAIN_vcpus, this->vcpus_ptr);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_pause_count, this->pause_count);
+            dom.get(DOMAIN_paging_mode, this->paging_mode);
+            dom.get(DOMAIN_tot_pages, this->tot_pages);
+            dom.get(DOMAIN_max_pages, this->max_pages);
+            dom.get(DOMAIN_shr_pages, (uint32_t&)this->shr_pages);
 
-            memory.read_block_vaddr(this->xenpt, this->domain_ptr + DOMAIN_handle,
-                                    (char*)this->handle, sizeof this->handle);
+            dom.get(DOMAIN_pause_count, this->pause_count);
 
-            memory.read64_vaddr(this->xenpt, this->domain_ptr + DOMAIN_next, this->next_domain_ptr);
+            dom.get(DOMAIN_handle, (char*)this->handle, sizeof this->handle);
+
+            dom.get(DOMAIN_next, this->next_domain_ptr);
 
             return true;
         }
@@ -117,6 +123,24 @@ namespace x86_64
             this->vcpus = new Abstract::VCPU*[this->max_cpus];
             std::memset(this->vcpus, 0, sizeof (Abstract::VCPU*) * this->max_cpus);
 
+            /* Each vcpu needs its own object, though guest pagetables are
+             * shared through host.ptregistry.  Domains with huge numbers of
+             * vcpus shouldn't exhaust the kdump kernel's memory, so drop the
+             * page cache and try again before giving up on this domain. */
+            size_t charge = this->max_cpus * ( sizeof (Abstract::VCPU*) +
+                                               sizeof (VCPU) );
+            if ( ! membudget.charge(charge) )
+            {
+                memory.shrink();
+                if ( ! membudget.charge(charge) )
+                {
+                    LOG_ERROR("    Insufficient memory budget for %"PRIu32" VCPUs\n",
+                              this->max_cpus);
+                    return false;
+                }
+            }
+            this->budget_charge = charge;
+
             LOG_INFO("    %"PRIu32" VCPUs\n", this->max_cpus);
             bool vcpus_online = false;
 
@@ -188,6 +188,7 @@ namespace x86_64
             this->phdrs[x].offset = phdr.p_offset;
             this->phdrs[x].phys   = phdr.p_paddr;
             this->phdrs[x].size   = phdr.p_filesz;
+            this->phdrs[x].memsz  = phdr.p_memsz;
         }
 
         return true;
@@ -0,0 +1,109 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/pagetable-registry.cpp
+ */
+
+#include "arch/x86_64/pagetable-registry.hpp"
+#include "arch/x86_64/pagetable.hpp"
+
+#include "util/macros.hpp"
+
+namespace x86_64
+{
+    PageTableRegistry::PageTableRegistry():
+        entries(), keys()
+    {}
+
+    PageTableRegistry::~PageTableRegistry()
+    {
+        for ( std::map<Key, Entry>::iterator itt = this->entries.begin();
+              itt != this->entries.end(); ++itt )
+            SAFE_DELETE(itt->second.pt);
+    }
+
+    Abstract::PageTable * PageTableRegistry::get(const uint64_t & root, Mode mode)
+    {
+        Key key(root, mode);
+        std::map<Key, Entry>::iterator itt = this->entries.find(key);
+        Entry e;
+
+        if ( itt != this->entries.end() )
+        {
+            ++itt->second.refs;
+            return itt->second.pt;
+        }
+
+        if ( mode == MODE_COMPAT )
+            e.pt = new PT64Compat(root);
+        else
+            e.pt = new PT64(root);
+        e.refs = 1;
+
+        try
+        {
+            this->keys[e.pt] = key;
+            this->entries[key] = e;
+        }
+        catch ( ... )
+        {
+            this->keys.erase(e.pt);
+            SAFE_DELETE(e.pt);
+            throw;
+        }
+
+        return e.pt;
+    }
+
+    void PageTableRegistry::put(Abstract::PageTable * pt)
+    {
+        std::map<const Abstract::PageTable *, Key>::iterator k;
+        std::map<Key, Entry>::iterator e;
+
+        if ( ! pt )
+            return;
+
+        k = this->keys.find(pt);
+        if ( k == this->keys.end() )
+        {
+            SAFE_DELETE(pt);
+            return;
+        }
+
+        e = this->entries.find(k->second);
+        if ( --e->second.refs )
+            return;
+
+        SAFE_DELETE(e->second.pt);
+        this->entries.erase(e);
+        this->keys.erase(k);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -27,6 +27,14 @@
 
 #include "util/log.hpp"
 #include "memory.hpp"
+#include "io-stats.hpp"
+#include "pte-cache.hpp"
+#include "mem-budget.hpp"
+#include "util/macros.hpp"
+
+#include <algorithm>
+#include <map>
+#include <new>
 
 /// Is the present bit set for a pagetable entry
 #define present(v)     ((v) & 1)
@@ -60,8 +68,55 @@
 /// Round an address up to the last byte in a 512G superpage
 #define roundup_512G(v) ((v) | ((1ULL<<39)-1))
 
-void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
-                       maddr_t & maddr, vaddr_t * page_end)
+/**
+ * Read an upper-level pagetable entry, via the paging-structure cache.
+ * @param addr Machine address of the entry.
+ * @param entry Variable for the entry.
+ */
+static inline void read_upper_entry(const maddr_t & addr, uint64_t & entry)
+{
+    if ( ptecache.lookup(addr, entry) )
+        return;
+
+    iostats.count_pt_read();
+    memory.read64(addr, entry);
+    ptecache.insert(addr, entry);
+}
+
+/**
+ * Translate the address of a pagetable page.
+ * @param p2m Guest physical address translator for a nested walk, or NULL.
+ * @param addr Address of the page, from cr3 or an upper level entry.
+ * @returns Machine address of the page.
+ */
+static inline maddr_t table_maddr(const GuestPhysMap * p2m, const uint64_t & addr)
+{
+    maddr_t maddr;
+    unsigned shift;
+
+    if ( ! p2m )
+        return addr;
+
+    p2m->translate(addr, maddr, shift);
+    return maddr;
+}
+
+/**
+ * Walk a 4 level pagetable.  Common to 64bit pagetables, EPT and the guest
+ * dimension of a nested walk.
+ * @param p2m Guest physical address translator for the pagetable pages, or
+ * NULL if the pagetables hold machine addresses.
+ * @param present_mask Entry bits of which any being set means present.
+ * @param cr3 Root of the pagetables.
+ * @param vaddr Address to look up.
+ * @param maddr Result of the walk, a guest physical address if p2m is set.
+ * @param page_end If non-null, variable for the last address of the page.
+ * @param page_shift If non-null, variable for log2 of the size of the page.
+ */
+static inline int walk_64(const GuestPhysMap * p2m, uint64_t present_mask,
+                          const maddr_t & cr3, const vaddr_t & vaddr,
+                          maddr_t & maddr, vaddr_t * page_end,
+                          unsigned * page_shift)
 {
     // cr3 has the pml4 physical address between bits 51 and 12
     // each page entry contain the next physical address between the same bits
@@ -80,6 +135,8 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
 
     maddr_t page;
 
+    iostats.count_walk();
+
     /* While this could technically be valid under x86 architecture, it is
      * certainly invalid under a sensible Xen setup, and implies a failure to
      * parse a {P,V}CPU correctly.
@@ -87,12 +144,12 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
     if ( ! cr3 )
         throw pagefault(vaddr, cr3, 5, pagefault::FAULT_INVALID);
 
-    memory.read64((cr3 & addr_mask) + pm4l_offset(vaddr),
-                  pml4_entry);
+    read_upper_entry(table_maddr(p2m, cr3 & addr_mask) + pm4l_offset(vaddr),
+                     pml4_entry);
 
     // PDPT present?
-    if ( ! present(pml4_entry) )
-        throw pagefault(vaddr, cr3, 4, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pml4_entry & present_mask) )
+        return 4;
 
     pdpt_base = pml4_entry & addr_mask;
 
@@ -102,15 +159,17 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
         maddr = offset_512G(pdpt_base, vaddr);
         if ( page_end )
             *page_end = roundup_512G(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 39;
+        return 0;
     }
 
-    memory.read64(pdpt_base + pdpt_offset(vaddr),
-                  pdpt_entry);
+    read_upper_entry(table_maddr(p2m, pdpt_base) + pdpt_offset(vaddr),
+                     pdpt_entry);
 
     // PD present?
-    if ( ! present(pdpt_entry) )
-        throw pagefault(vaddr, cr3, 3, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pdpt_entry & present_mask) )
+        return 3;
 
     pd_base = pdpt_entry & addr_mask;
 
@@ -120,15 +179,17 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
         maddr = offset_1G(pd_base, vaddr);
         if ( page_end )
             *page_end = roundup_1G(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 30;
+        return 0;
     }
 
-    memory.read64(pd_base + pd_offset(vaddr),
-                  pd_entry);
+    read_upper_entry(table_maddr(p2m, pd_base) + pd_offset(vaddr),
+                     pd_entry);
 
     // PT present?
-    if ( ! present(pd_entry) )
-        throw pagefault(vaddr, cr3, 2, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pd_entry & present_mask) )
+        return 2;
 
     pt_base = pd_entry & addr_mask;
 
@@ -138,20 +199,328 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
         maddr = offset_2M(pt_base, vaddr);
         if ( page_end )
             *page_end = roundup_2M(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 21;
+        return 0;
     }
 
-    memory.read64(pt_base + pt_offset(vaddr),
+    iostats.count_pt_read();
+    memory.read64(table_maddr(p2m, pt_base) + pt_offset(vaddr),
                   pt_entry);
 
     // Page present?
-    if ( ! present(pt_entry) )
-        throw pagefault(vaddr, cr3, 1, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pt_entry & present_mask) )
+        return 1;
 
     page = pt_entry & addr_mask;
     maddr = offset_4K(page, vaddr);
     if ( page_end )
         *page_end = roundup_4K(vaddr);
+    if ( page_shift )
+        *page_shift = 12;
+    return 0;
+}
+
+void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                       maddr_t & maddr, vaddr_t * page_end,
+                       unsigned * page_shift)
+{
+    int level = walk_64(NULL, PTE_PRESENT, cr3, vaddr, maddr, page_end,
+                        page_shift);
+
+    if ( level )
+        throw pagefault(vaddr, cr3, level, pagefault::FAULT_NOTPRESENT);
+}
+
+int pagetable_try_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                          maddr_t & maddr, vaddr_t * page_end,
+                          unsigned * page_shift)
+{
+    return walk_64(NULL, PTE_PRESENT, cr3, vaddr, maddr, page_end,
+                   page_shift);
+}
+
+void ept_walk_64(const maddr_t & eptp, const uint64_t & gpa,
+                 maddr_t & maddr, unsigned * page_shift)
+{
+    // Read, write and execute permissions.
+    static const uint64_t ept_present = 7;
+    int level = walk_64(NULL, ept_present, eptp, gpa, maddr, NULL, page_shift);
+
+    if ( level )
+        throw pagefault(gpa, eptp, level, pagefault::FAULT_NOTPRESENT);
+}
+
+void pagetable_walk_nested_64(const GuestPhysMap & p2m, const uint64_t & cr3,
+                              const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end, unsigned * page_shift)
+{
+    uint64_t gpa;
+    unsigned guest_shift, p2m_shift, shift;
+
+    int level = walk_64(&p2m, PTE_PRESENT, cr3, vaddr, gpa, NULL, &guest_shift);
+
+    if ( level )
+        throw pagefault(vaddr, cr3, level, pagefault::FAULT_NOTPRESENT);
+    p2m.translate(gpa, maddr, p2m_shift);
+
+    /* A guest superpage may be backed by smaller p2m pages and vice versa;
+     * only the smaller of the two is contiguous in both. */
+    shift = guest_shift < p2m_shift ? guest_shift : p2m_shift;
+    if ( page_end )
+        *page_end = vaddr | ((1ULL << shift) - 1);
+    if ( page_shift )
+        *page_shift = shift;
+}
+
+/**
+ * State of one pagetable_enumerate_64() call.
+ */
+class Enumeration
+{
+public:
+    /**
+     * Constructor.
+     * @param visitor Receiver of the mappings.
+     * @param limit Last virtual address to enumerate.
+     */
+    Enumeration(MappingVisitor & visitor, const vaddr_t & limit):
+        visitor(visitor), limit(limit), run(), have_run(false), missing(0),
+        tables(), budget_charge(0)
+    {}
+
+    /// Destructor.
+    ~Enumeration();
+
+    /**
+     * Enumerate one pagetable page.
+     * @param table Machine address of the pagetable page.
+     * @param level Level of the page, 4 for the PML4 down to 1 for a PT.
+     * @param base First virtual address mapped by the page.
+     * @param flags Effective flags of the levels above.
+     * @returns boolean indicating whether enumeration should continue.
+     */
+    bool table(const maddr_t & table, int level, const vaddr_t & base,
+               uint64_t flags);
+
+    /**
+     * Deliver the pending run, if any.
+     * @returns boolean indicating whether enumeration should continue.
+     */
+    bool flush();
+
+    /// Receiver of the mappings.
+    MappingVisitor & visitor;
+    /// Last virtual address to enumerate.
+    vaddr_t limit;
+    /// Pending run, extended while mappings stay contiguous.
+    Mapping run;
+    /// Whether run is valid.
+    bool have_run;
+    /// Number of pagetable pages which couldn't be read.
+    uint64_t missing;
+
+private:
+    /**
+     * Add a leaf mapping, merging it into the pending run if possible.
+     * @param vaddr First virtual address of the page.
+     * @param maddr Machine address of the page.
+     * @param shift log2 of the page size.
+     * @param flags Effective flags.
+     * @returns boolean indicating whether enumeration should continue.
+     */
+    bool leaf(const vaddr_t & vaddr, const maddr_t & maddr, unsigned shift,
+              uint64_t flags);
+
+    /**
+     * Fetch the entries of a pagetable page, from the table cache if it
+     * has been seen before in this enumeration.
+     * @param table Machine address of the pagetable page.
+     * @param level Level of the page.
+     * @param entries Buffer for the entries, if they need reading.
+     * @returns The entries, or NULL if the page couldn't be read.
+     */
+    const uint64_t * fetch(const maddr_t & table, int level, uint64_t * entries);
+
+    /// Key of the table cache: machine address and level.
+    typedef std::pair<maddr_t, int> TableKey;
+    /// Type of the table cache.
+    typedef std::map<TableKey, uint64_t *> TableMap;
+
+    /**
+     * Contents of the pagetable pages read so far, so tables shared
+     * between several entries are only read once.  A NULL value marks a
+     * page which couldn't be read.
+     */
+    TableMap tables;
+    /// Bytes charged to membudget for the table cache.
+    size_t budget_charge;
+
+    // @cond EXCLUDE
+    Enumeration(const Enumeration &);
+    Enumeration & operator= (const Enumeration &);
+    // @endcond
+};
+
+bool Enumeration::table(const maddr_t & table, int level, const vaddr_t & base,
+                        uint64_t flags)
+{
+    static const uint64_t addr_mask = 0x000FFFFFFFFFF000ULL;
+    unsigned shift = 12 + 9 * (level - 1);
+    uint64_t buffer[512];
+    const uint64_t * entries;
+
+    if ( ! this->visitor.enter_table(table & addr_mask, level, base) )
+        return true;
+
+    if ( ! (entries = this->fetch(table & addr_mask, level, buffer)) )
+    {
+        LOG_DEBUG("Unable to read level %d pagetable at 0x%016"PRIx64
+                  " mapping 0x%016"PRIx64"\n", level, table & addr_mask, base);
+        ++this->missing;
+        return true;
+    }
+
+    for ( unsigned x = 0; x < 512; ++x )
+    {
+        uint64_t entry = entries[x];
+        vaddr_t vaddr = base | ((uint64_t)x << shift);
+        uint64_t eff;
+
+        // Sign extend the upper half of the address space.
+        if ( level == 4 && x >= 256 )
+            vaddr |= 0xffff000000000000ULL;
+
+        if ( vaddr > this->limit )
+            break;
+
+        if ( ! present(entry) )
+            continue;
+
+        eff = PTE_PRESENT |
+            ( flags & entry & (PTE_RW | PTE_USER) ) |
+            ( (flags | entry) & PTE_NX ) |
+            ( entry & (PTE_PWT | PTE_PCD | PTE_GLOBAL) );
+
+        if ( level == 1 || page_size(entry) )
+        {
+            if ( ! this->leaf(vaddr, entry & addr_mask & ~((1ULL << shift) - 1),
+                              shift, eff) )
+                return false;
+        }
+        else if ( ! this->table(entry, level - 1, vaddr, eff) )
+            return false;
+    }
+
+    return true;
+}
+
+const uint64_t * Enumeration::fetch(const maddr_t & table, int level,
+                                    uint64_t * entries)
+{
+    static const size_t table_size = 512 * sizeof (uint64_t);
+    TableKey key(table, level);
+    TableMap::const_iterator it = this->tables.find(key);
+    uint64_t * copy = NULL;
+
+    if ( it != this->tables.end() )
+        return it->second;
+
+    try
+    {
+        iostats.count_pt_read();
+        memory.read_block(table, (char*)entries, table_size);
+    }
+    catch ( const CommonError & )
+    {
+        entries = NULL;
+    }
+
+    // Remember the table if the budget allows; failing that, just reread it.
+    if ( membudget.charge(table_size) )
+    {
+        try
+        {
+            if ( entries )
+            {
+                copy = new uint64_t[512];
+                std::copy(entries, entries + 512, copy);
+            }
+            this->tables.insert(std::make_pair(key, copy));
+            this->budget_charge += table_size;
+        }
+        catch ( const std::bad_alloc & )
+        {
+            SAFE_DELETE_ARRAY(copy);
+            membudget.uncharge(table_size);
+        }
+    }
+
+    return entries;
+}
+
+Enumeration::~Enumeration()
+{
+    for ( TableMap::iterator it = this->tables.begin(); it != this->tables.end(); ++it )
+        SAFE_DELETE_ARRAY(it->second);
+    membudget.uncharge(this->budget_charge);
+}
+
+bool Enumeration::leaf(const vaddr_t & vaddr, const maddr_t & maddr,
+                       unsigned shift, uint64_t flags)
+{
+    uint64_t len = 1ULL << shift;
+
+    // Clip a large page which straddles the limit.
+    if ( vaddr + (len - 1) > this->limit )
+        len = this->limit - vaddr + 1;
+
+    if ( this->have_run &&
+         this->run.vaddr + this->run.len == vaddr &&
+         this->run.maddr + this->run.len == maddr &&
+         this->run.page_shift == shift &&
+         this->run.flags == flags )
+    {
+        this->run.len += len;
+        return true;
+    }
+
+    if ( ! this->flush() )
+        return false;
+
+    this->run.vaddr = vaddr;
+    this->run.len = len;
+    this->run.maddr = maddr;
+    this->run.page_shift = shift;
+    this->run.flags = flags;
+    this->have_run = true;
+    return true;
+}
+
+bool Enumeration::flush()
+{
+    if ( ! this->have_run )
+        return true;
+
+    this->have_run = false;
+    return this->visitor.visit(this->run);
+}
+
+bool pagetable_enumerate_64(const maddr_t & cr3, MappingVisitor & visitor,
+                            const vaddr_t & limit, uint64_t * missing)
+{
+    Enumeration e(visitor, limit);
+    bool complete = true;
+
+    // As for pagetable_walk_64(), a cr3 of 0 implies a parsing failure.
+    if ( cr3 )
+        complete = e.table(cr3, 4, 0, PTE_RW | PTE_USER) && e.flush();
+    else
+        ++e.missing;
+
+    if ( missing )
+        *missing = e.missing;
+    return complete;
 }
 
 /*
@@ -26,15 +26,75 @@
 #include "arch/x86_64/pagetable.hpp"
 #include "arch/x86_64/pagetable-walk.hpp"
 
+#include "abstract/xensyms.hpp"
+#include "Xen.h"
 #include "exceptions.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+
+#include <algorithm>
+
+using namespace Abstract::xensyms;
 
 namespace x86_64
 {
-    PT64::PT64(const uint64_t & cr3):cr3(cr3) {};
+    /**
+     * Cached walk of 64bit pagetables, common to PT64 and PT64Compat.
+     * @param tlb Translation cache for the pagetables.
+     * @param cr3 Control Register 3.
+     * @param vaddr Virtual address to look up.
+     * @param maddr Machine address variable for the result.
+     * @param page_end If non-null, variable for the last virtual address
+     * of the page, or of the not present range.
+     * @param level If non-null, variable for the level of a not present entry.
+     * @returns Status of the walk.
+     */
+    static Abstract::PageTable::WalkStatus cached_walk_64(
+        TLB & tlb, const uint64_t & cr3, const vaddr_t & vaddr, maddr_t & maddr,
+        vaddr_t * page_end, int * level)
+    {
+        unsigned shift;
+        int absent;
+
+        if ( tlb.lookup(vaddr, maddr, page_end) )
+            return Abstract::PageTable::WALK_OK;
+
+        if ( ! tlb.lookup_absent(vaddr, absent, page_end) )
+        {
+            absent = pagetable_try_walk_64(cr3, vaddr, maddr, page_end, &shift);
+
+            if ( ! absent )
+            {
+                tlb.insert(vaddr, maddr, shift);
+                return Abstract::PageTable::WALK_OK;
+            }
+
+            tlb.insert_absent(vaddr, absent);
+            if ( page_end )
+                *page_end = vaddr | ((1ULL << (12 + 9 * (absent - 1))) - 1);
+        }
+
+        if ( level )
+            *level = absent;
+        return Abstract::PageTable::WALK_NOTPRESENT;
+    }
+
+    PT64::PT64(const uint64_t & cr3):cr3(cr3), tlb() {};
     PT64::~PT64() {};
 
     void PT64::walk(const vaddr_t & vaddr, maddr_t & maddr,
                        vaddr_t * page_end) const
+    {
+        int level;
+
+        if ( this->try_walk(vaddr, maddr, page_end, &level) != WALK_OK )
+            throw pagefault(vaddr, this->cr3, level, pagefault::FAULT_NOTPRESENT);
+    }
+
+    Abstract::PageTable::WalkStatus PT64::try_walk(const vaddr_t & vaddr,
+                                                   maddr_t & maddr,
+                                                   vaddr_t * page_end,
+                                                   int * level) const
     {
         /* Verify the pointer is canonical.  If not, the vaddr is
          * certainly junk. */
@@ -42,26 +102,189 @@ namespace x86_64
              vaddr < 0xffff800000000000ULL )
             throw validate(vaddr, "Address is non-canonical.");
 
-        pagetable_walk_64(this->cr3, vaddr, maddr, page_end);
+        return cached_walk_64(this->tlb, this->cr3, vaddr, maddr, page_end, level);
     }
 
     uint64_t PT64::root() const { return this->cr3; }
 
-    PT64Compat::PT64Compat(const uint64_t & cr3):cr3(cr3) {};
+    void PT64::invalidate() const { this->tlb.flush(); }
+
+    void PT64::invalidate(const vaddr_t & vaddr) const { this->tlb.flush(vaddr); }
+
+    bool PT64::enumerate(MappingVisitor & visitor, uint64_t * missing) const
+    {
+        return pagetable_enumerate_64(this->cr3, visitor, ~0ULL, missing);
+    }
+
+    PT64Compat::PT64Compat(const uint64_t & cr3):cr3(cr3), tlb() {};
     PT64Compat::~PT64Compat() {};
 
     void PT64Compat::walk(const vaddr_t & vaddr, maddr_t & maddr,
                        vaddr_t * page_end) const
+    {
+        int level;
+
+        if ( this->try_walk(vaddr, maddr, page_end, &level) != WALK_OK )
+            throw pagefault(vaddr, this->cr3, level, pagefault::FAULT_NOTPRESENT);
+    }
+
+    Abstract::PageTable::WalkStatus PT64Compat::try_walk(const vaddr_t & vaddr,
+                                                         maddr_t & maddr,
+                                                         vaddr_t * page_end,
+                                                         int * level) const
     {
         /* Long compat mode uses 32bit pointers running on the same
          * 64bit pagetables, with a 0-extended pointer. */
         if ( vaddr & 0xffffffff00000000ULL )
             throw validate(vaddr, "Pointer out of range for 64bit Compat pagetables.");
 
-        pagetable_walk_64(this->cr3, vaddr, maddr, page_end);
+        return cached_walk_64(this->tlb, this->cr3, vaddr, maddr, page_end, level);
     }
 
     uint64_t PT64Compat::root() const { return this->cr3; }
+
+    void PT64Compat::invalidate() const { this->tlb.flush(); }
+
+    void PT64Compat::invalidate(const vaddr_t & vaddr) const { this->tlb.flush(vaddr); }
+
+    bool PT64Compat::enumerate(MappingVisitor & visitor, uint64_t * missing) const
+    {
+        return pagetable_enumerate_64(this->cr3, visitor, 0xffffffffULL, missing);
+    }
+
+    DirectMapPT::DirectMapPT(Abstract::PageTable * pt, bool verify):
+        pt(pt), verify(verify), checked(), usable(true) {};
+
+    DirectMapPT::~DirectMapPT()
+    {
+        SAFE_DELETE(this->pt);
+    }
+
+    void DirectMapPT::walk(const vaddr_t & vaddr, maddr_t & maddr,
+                           vaddr_t * page_end) const
+    {
+        maddr_t walked;
+        vaddr_t end;
+        std::map<vaddr_t, vaddr_t>::iterator it;
+
+        if ( ! this->usable || ! HAVE_CORE_XENSYMS(virt) ||
+             vaddr < VIRT_DIRECTMAP_START || vaddr >= VIRT_DIRECTMAP_END )
+        {
+            this->pt->walk(vaddr, maddr, page_end);
+            return;
+        }
+
+        it = this->checked.lower_bound(vaddr);
+        if ( ! this->verify && it != this->checked.end() && it->second <= vaddr )
+        {
+            maddr = vaddr - VIRT_DIRECTMAP_START;
+            if ( page_end )
+                *page_end = vaddr | (PAGE_SIZE - 1);
+            return;
+        }
+
+        /* Real walk.  Faults propagate, as the direct map only covers RAM
+         * and the arithmetic would silently translate holes. */
+        this->pt->walk(vaddr, walked, &end);
+
+        if ( walked == vaddr - VIRT_DIRECTMAP_START )
+        {
+            it = this->checked.insert(std::make_pair(end, vaddr)).first;
+            it->second = std::min(it->second, (vaddr_t)(vaddr & ~(PAGE_SIZE - 1)));
+        }
+        else
+        {
+            LOG_ERROR("Direct map translation of 0x%016"PRIx64" gave 0x%016"PRIx64
+                      ", but the pagetables give 0x%016"PRIx64".  Disabling the "
+                      "direct map fast path\n", vaddr, vaddr - VIRT_DIRECTMAP_START,
+                      walked);
+            this->usable = false;
+        }
+
+        maddr = walked;
+        if ( page_end )
+            *page_end = vaddr | (PAGE_SIZE - 1);
+    }
+
+    Abstract::PageTable::WalkStatus DirectMapPT::try_walk(const vaddr_t & vaddr,
+                                                          maddr_t & maddr,
+                                                          vaddr_t * page_end,
+                                                          int * level) const
+    {
+        if ( ! this->usable || ! HAVE_CORE_XENSYMS(virt) ||
+             vaddr < VIRT_DIRECTMAP_START || vaddr >= VIRT_DIRECTMAP_END )
+            return this->pt->try_walk(vaddr, maddr, page_end, level);
+
+        return Abstract::PageTable::try_walk(vaddr, maddr, page_end, level);
+    }
+
+    uint64_t DirectMapPT::root() const { return this->pt->root(); }
+
+    void DirectMapPT::invalidate() const { this->pt->invalidate(); }
+
+    void DirectMapPT::invalidate(const vaddr_t & vaddr) const { this->pt->invalidate(vaddr); }
+
+    P2M::P2M(const maddr_t & table, bool ept):table(table), ept(ept), tlb() {};
+    P2M::~P2M() {};
+
+    void P2M::translate(const uint64_t & gpa, maddr_t & maddr,
+                        unsigned & page_shift) const
+    {
+        // Guest physical addresses are bounded as machine addresses are.
+        if ( gpa & 0xfff0000000000000ULL )
+            throw validate(gpa, "Guest physical address out of range.");
+
+        if ( this->tlb.lookup(gpa, maddr, NULL, &page_shift) )
+            return;
+
+        if ( this->ept )
+            ept_walk_64(this->table, gpa, maddr, &page_shift);
+        else
+            pagetable_walk_64(this->table, gpa, maddr, NULL, &page_shift);
+        this->tlb.insert(gpa, maddr, page_shift);
+    }
+
+    void P2M::invalidate() const { this->tlb.flush(); }
+
+    HAPPT::HAPPT(const maddr_t & p2m_table, bool ept, const uint64_t & cr3,
+                 bool paging):
+        p2m(p2m_table, ept), cr3(cr3), paging(paging), tlb() {};
+    HAPPT::~HAPPT() {};
+
+    void HAPPT::walk(const vaddr_t & vaddr, maddr_t & maddr,
+                     vaddr_t * page_end) const
+    {
+        unsigned shift;
+
+        if ( ! this->paging )
+        {
+            this->p2m.translate(vaddr, maddr, shift);
+            if ( page_end )
+                *page_end = vaddr | ((1ULL << shift) - 1);
+            return;
+        }
+
+        if ( vaddr > 0x00007fffffffffffULL &&
+             vaddr < 0xffff800000000000ULL )
+            throw validate(vaddr, "Address is non-canonical.");
+
+        if ( this->tlb.lookup(vaddr, maddr, page_end) )
+            return;
+
+        pagetable_walk_nested_64(this->p2m, this->cr3, vaddr, maddr,
+                                 page_end, &shift);
+        this->tlb.insert(vaddr, maddr, shift);
+    }
+
+    uint64_t HAPPT::root() const { return this->cr3; }
+
+    void HAPPT::invalidate() const
+    {
+        this->tlb.flush();
+        this->p2m.invalidate();
+    }
+
+    void HAPPT::invalidate(const vaddr_t & vaddr) const { this->tlb.flush(vaddr); }
 }
 
 /*
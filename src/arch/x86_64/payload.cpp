@@ -40,26 +40,20 @@ namespace x86_64
 
         decode_common();
 
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_text_addr,
-                            text_addr);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_text_size,
-                            text_size);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_rw_addr,
-                            rw_addr);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_rw_size,
-                            rw_size);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_ro_addr,
-                            ro_addr);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_ro_size,
-                            ro_size);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_symtab,
-                            symtab_ptr);
-        memory.read32_vaddr(xenpt, payload_addr + LIVEPATCH_payload_nsyms,
-                            nsyms);
-        memory.read64_vaddr(xenpt, payload_addr + LIVEPATCH_payload_buildid,
-                            buildid_ptr);
-        memory.read32_vaddr(xenpt, payload_addr + LIVEPATCH_payload_buildid_len,
-                            buildid_len);
+        ReadBatch batch;
+
+        batch.add(payload_addr + LIVEPATCH_payload_text_addr, text_addr);
+        batch.add(payload_addr + LIVEPATCH_payload_text_size, text_size);
+        batch.add(payload_addr + LIVEPATCH_payload_rw_addr, rw_addr);
+        batch.add(payload_addr + LIVEPATCH_payload_rw_size, rw_size);
+        batch.add(payload_addr + LIVEPATCH_payload_ro_addr, ro_addr);
+        batch.add(payload_addr + LIVEPATCH_payload_ro_size, ro_size);
+        batch.add(payload_addr + LIVEPATCH_payload_symtab, symtab_ptr);
+        batch.add(payload_addr + LIVEPATCH_payload_nsyms, nsyms);
+        batch.add(payload_addr + LIVEPATCH_payload_buildid, buildid_ptr);
+        batch.add(payload_addr + LIVEPATCH_payload_buildid_len, buildid_len);
+        memory.read_batch_vaddr(xenpt, batch);
+
         if ( buildid_len <= 128 )
         {
             buildid = new uint8_t[buildid_len];
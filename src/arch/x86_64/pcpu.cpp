@@ -41,6 +41,7 @@
 #include "util/stdio-wrapper.hpp"
 #include "util/misc.hpp"
 #include "memory.hpp"
+#include "io-stats.hpp"
 
 #include <new>
 
@@ -145,7 +146,8 @@ namespace x86_64
 
         try
         {
-            this->xenpt = new PT64(this->regs.cr3);
+            this->xenpt = new DirectMapPT(new PT64(this->regs.cr3),
+                                          host.verify_directmap);
         }
         catch ( const std::bad_alloc & )
         {
@@ -163,7 +165,7 @@ namespace x86_64
     {
         try
         {
-            this->xenpt = new PT64(cr3);
+            this->xenpt = new DirectMapPT(new PT64(cr3), host.verify_directmap);
 
             if ( stack_base == 0 )
             {
@@ -504,6 +506,7 @@ namespace x86_64
     int PCPU::dump_stack(FILE * o) const
     {
         static const char * stack_name[] = { "Double Fault", "NMI", "MCE", "Normal" };
+        IOStatScope stat_scope(IOSTAT_STACK);
 
         vaddr_t stack_min = this->regs.rsp & ~(STACK_SIZE-1);
         vaddr_t stack_max = stack_min | (STACK_SIZE-1);
@@ -529,21 +532,21 @@ namespace x86_64
                 vaddr_t page_max  = page_base | (PAGE_SIZE-1);
 
                 maddr_t frame;
+                int level;
 
                 len += FPRINTF(o, "Stack page %d, 0x%016"PRIx64"-0x%016"PRIx64" (%s stack)\n",
                                stack_page, page_base, page_max, stack_name[std::min(stack_page,3)]);
-                try
-                {
-                    this->xenpt->walk(page_base, frame, NULL);
-                }
-                catch ( const pagefault & e )
+
+                if ( this->xenpt->try_walk(page_base, frame, NULL, &level) !=
+                     Abstract::PageTable::WALK_OK )
                 {
-                    if ( e.level == 1 && e.reason == pagefault::FAULT_NOTPRESENT)
+                    if ( level == 1 )
                     {
                         len += FPUTS("  Not present (Guard page?)\n\n", o);
                         continue;
                     }
-                    throw;
+                    throw pagefault(page_base, this->xenpt->root(), level,
+                                    pagefault::FAULT_NOTPRESENT);
                 }
 
                 len += FPUTS("\n", o);
@@ -601,6 +604,7 @@ namespace x86_64
     int PCPU::print_stack(FILE * o, const vaddr_t & stack, unsigned mask) const
     {
         static const char * stack_name[] = { "Double Fault", "NMI", "MCE", "Normal" };
+        IOStatScope stat_scope(IOSTAT_STACK);
         uint64_t sp = stack;
         int len = 0;
 
@@ -636,11 +640,26 @@ namespace x86_64
                 stack_top |= STACK_SIZE - CPUINFO_sizeof;
             }
 
-            while ( sp < stack_top )
+            // Translate every word up front; the stack spans up to 8 pages.
+            std::vector<Abstract::PageTable::Translation> words;
+            for ( vaddr_t addr = sp; addr < stack_top; addr += 8 )
+            {
+                Abstract::PageTable::Translation t =
+                    { addr, 0, Abstract::PageTable::WALK_OK, 0 };
+                words.push_back(t);
+            }
+            if ( ! words.empty() )
+                this->xenpt->walk_many(&words[0], words.size());
+
+            for ( size_t x = 0; x < words.size(); ++x, sp += 8 )
             {
-                memory.read64_vaddr(*this->xenpt, sp, val);
+                // Walk again for the exception if the translation failed.
+                if ( words[x].status == Abstract::PageTable::WALK_OK )
+                    memory.read64(words[x].maddr, val);
+                else
+                    memory.read64_vaddr(*this->xenpt, sp, val);
+
                 len += host.symtab.print_symbol64(o, val);
-                sp += 8;
             }
 
             if ( stack_page <= 2 )
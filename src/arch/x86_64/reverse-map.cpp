@@ -0,0 +1,339 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/reverse-map.cpp
+ */
+
+#include "arch/x86_64/reverse-map.hpp"
+#include "arch/x86_64/pagetable-walk.hpp"
+
+#include "Xen.h"
+#include "mem-budget.hpp"
+#include "util/log.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <cstdarg>
+#include <cstdio>
+
+/// Number of runs charged to the memory budget at a time.
+#define RMAP_CHUNK 4096
+
+namespace x86_64
+{
+    /**
+     * Enumeration visitor which fills a ReverseMap.
+     */
+    class RmapBuilder: public MappingVisitor
+    {
+    public:
+        /**
+         * Constructor.
+         * @param rmap Reverse map to fill.
+         */
+        RmapBuilder(ReverseMap & rmap):
+            rmap(rmap), root(0), refused(false), seen()
+        {}
+
+        virtual bool visit(const Mapping & mapping)
+        {
+            ReverseMap::Run r = { mapping.maddr, mapping.len, mapping.vaddr,
+                                  this->root };
+
+            if ( this->rmap.runs.size() * sizeof r >= this->rmap.budget_charge )
+            {
+                if ( ! membudget.charge(RMAP_CHUNK * sizeof r) )
+                {
+                    this->refused = true;
+                    return false;
+                }
+                this->rmap.budget_charge += RMAP_CHUNK * sizeof r;
+            }
+
+            this->rmap.runs.push_back(r);
+            return true;
+        }
+
+        virtual bool enter_table(const maddr_t & table, int level,
+                                 const vaddr_t & base)
+        {
+            /* Leaf tables are rarely shared, and tracking them would cost
+             * far more than enumerating them. */
+            if ( level == 1 )
+                return true;
+
+            std::pair<maddr_t, vaddr_t> key(table | level, base);
+            std::map<std::pair<maddr_t, vaddr_t>, uint32_t>::const_iterator it =
+                this->seen.find(key);
+
+            if ( it == this->seen.end() )
+            {
+                this->seen[key] = this->root;
+                return true;
+            }
+
+            if ( it->second == this->root )
+                return true;
+
+            ReverseMap::Alias a;
+
+            a.owner = it->second;
+            a.root = this->root;
+            a.start = base;
+            // A PML4 covers both halves of the canonical address space.
+            a.end = ( level == 4 ) ? ~0ULL :
+                base + ((1ULL << (12 + 9 * level)) - 1);
+            if ( a.end > this->rmap.roots[this->root].limit )
+                a.end = this->rmap.roots[this->root].limit;
+
+            this->rmap.aliases.push_back(a);
+            return false;
+        }
+
+        /// Reverse map being filled.
+        ReverseMap & rmap;
+        /// Index of the root being enumerated.
+        uint32_t root;
+        /// Whether the memory budget refused the runs.
+        bool refused;
+
+    private:
+        /// Upper level tables enumerated so far, keyed on (table | level, base).
+        std::map<std::pair<maddr_t, vaddr_t>, uint32_t> seen;
+
+        // @cond EXCLUDE
+        RmapBuilder(const RmapBuilder &);
+        RmapBuilder & operator= (const RmapBuilder &);
+        // @endcond
+    };
+
+    ReverseMap::ReverseMap():
+        roots(), runs(), nodes(), by_start(), by_end(), aliases(), built(false),
+        budget_charge(0)
+    {}
+
+    ReverseMap::~ReverseMap()
+    {
+        this->clear();
+    }
+
+    void ReverseMap::add_root(const maddr_t & cr3, const vaddr_t & limit,
+                              const char * fmt, ...)
+    {
+        Root r;
+        va_list args;
+
+        r.cr3 = cr3;
+        r.limit = limit;
+        va_start(args, fmt);
+        vsnprintf(r.label, sizeof r.label, fmt, args);
+        va_end(args);
+
+        this->clear();
+        this->roots.push_back(r);
+    }
+
+    void ReverseMap::clear()
+    {
+        std::vector<Run>().swap(this->runs);
+        std::vector<Node>().swap(this->nodes);
+        std::vector<uint32_t>().swap(this->by_start);
+        std::vector<uint32_t>().swap(this->by_end);
+        std::vector<Alias>().swap(this->aliases);
+
+        membudget.uncharge(this->budget_charge);
+        this->budget_charge = 0;
+        this->built = false;
+    }
+
+    bool ReverseMap::build()
+    {
+        RmapBuilder builder(*this);
+        uint64_t missing, total_missing = 0;
+
+        if ( this->built )
+            return true;
+
+        LOG_DEBUG("Building reverse map over %zu pagetable roots\n",
+                  this->roots.size());
+
+        for ( uint32_t x = 0; x < this->roots.size(); ++x )
+        {
+            builder.root = x;
+            pagetable_enumerate_64(this->roots[x].cr3, builder,
+                                   this->roots[x].limit, &missing);
+            total_missing += missing;
+
+            if ( builder.refused )
+            {
+                LOG_WARN("Insufficient memory budget for the reverse map\n");
+                this->clear();
+                return false;
+            }
+        }
+
+        std::sort(this->runs.begin(), this->runs.end(), ReverseMap::run_before);
+
+        // Every run lands in exactly one node, and every node has a run.
+        size_t tree_charge = this->runs.size() *
+            ( sizeof (Node) + 2 * sizeof (uint32_t) );
+        if ( ! membudget.charge(tree_charge) )
+        {
+            LOG_WARN("Insufficient memory budget for the reverse map\n");
+            this->clear();
+            return false;
+        }
+        this->budget_charge += tree_charge;
+
+        try
+        {
+            std::vector<uint32_t> all(this->runs.size());
+
+            for ( uint32_t x = 0; x < all.size(); ++x )
+                all[x] = x;
+
+            this->nodes.reserve(this->runs.size());
+            this->by_start.reserve(this->runs.size());
+            this->by_end.reserve(this->runs.size());
+            this->build_node(all);
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            this->clear();
+            return false;
+        }
+
+        LOG_DEBUG("Reverse map has %zu runs and %zu aliases, %"PRIu64
+                  " pagetable pages missing\n", this->runs.size(),
+                  this->aliases.size(), total_missing);
+
+        this->built = true;
+        return true;
+    }
+
+    uint32_t ReverseMap::build_node(const std::vector<uint32_t> & set)
+    {
+        std::vector<uint32_t> left, right;
+        std::vector<std::pair<maddr_t, uint32_t> > ends;
+        uint32_t index = this->nodes.size();
+        Node n;
+
+        if ( set.empty() )
+            return NO_NODE;
+
+        /* Centre on the start of the median run.  That run is in this node,
+         * and each subtree gets at most half of the rest. */
+        n.centre = this->runs[set[set.size() / 2]].maddr;
+        n.first = this->by_start.size();
+        n.left = n.right = NO_NODE;
+
+        for ( size_t x = 0; x < set.size(); ++x )
+        {
+            const Run & r = this->runs[set[x]];
+            maddr_t end = r.maddr + (r.len - 1);
+
+            if ( end < n.centre )
+                left.push_back(set[x]);
+            else if ( r.maddr > n.centre )
+                right.push_back(set[x]);
+            else
+            {
+                this->by_start.push_back(set[x]);
+                ends.push_back(std::make_pair(end, set[x]));
+            }
+        }
+
+        std::sort(ends.begin(), ends.end(),
+                  std::greater<std::pair<maddr_t, uint32_t> >());
+        for ( size_t x = 0; x < ends.size(); ++x )
+            this->by_end.push_back(ends[x].second);
+
+        n.count = ends.size();
+        this->nodes.push_back(n);
+
+        n.left = this->build_node(left);
+        n.right = this->build_node(right);
+        this->nodes[index].left = n.left;
+        this->nodes[index].right = n.right;
+        return index;
+    }
+
+    void ReverseMap::lookup(const uint64_t & mfn, std::vector<Hit> & hits) const
+    {
+        maddr_t addr = mfn << PAGE_SHIFT;
+        std::vector<std::pair<uint32_t, vaddr_t> > work;
+        uint32_t n = this->nodes.empty() ? NO_NODE : 0;
+
+        hits.clear();
+
+        /* Every run of a node contains its centre, so below the centre the
+         * hits are a prefix of the runs by start, and above it a prefix of
+         * the runs by end. */
+        while ( n != NO_NODE )
+        {
+            const Node & node = this->nodes[n];
+            const std::vector<uint32_t> & order =
+                ( addr < node.centre ) ? this->by_start : this->by_end;
+
+            for ( uint32_t x = node.first; x < node.first + node.count; ++x )
+            {
+                const Run & r = this->runs[order[x]];
+
+                if ( addr - r.maddr >= r.len )
+                    break;
+                work.push_back(std::make_pair(r.root, r.vaddr + (addr - r.maddr)));
+            }
+
+            n = ( addr < node.centre ) ? node.left :
+                ( addr > node.centre ) ? node.right : NO_NODE;
+        }
+
+        /* Each hit is also a hit in every root aliasing that range.  Aliases
+         * always point at an earlier root, so this terminates. */
+        while ( ! work.empty() )
+        {
+            std::pair<uint32_t, vaddr_t> w = work.back();
+            const Root & root = this->roots[w.first];
+            Hit h = { root.label, root.cr3, w.second };
+
+            work.pop_back();
+            hits.push_back(h);
+
+            for ( std::vector<Alias>::const_iterator a = this->aliases.begin();
+                  a != this->aliases.end(); ++a )
+                if ( a->owner == w.first && a->start <= w.second &&
+                     w.second <= a->end )
+                    work.push_back(std::make_pair(a->root, w.second));
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
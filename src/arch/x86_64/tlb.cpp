@@ -0,0 +1,248 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "arch/x86_64/tlb.hpp"
+#include "mem-budget.hpp"
+#include "io-stats.hpp"
+#include "util/macros.hpp"
+
+/**
+ * @file src/arch/x86_64/tlb.cpp
+ */
+
+namespace x86_64
+{
+    /// Direct-mapped set of entries for one page size.
+    struct TLBSet
+    {
+        /// log2 of the page size.
+        unsigned shift;
+        /// Number of entries.  Must be a power of two.
+        unsigned nr;
+        /// Index of the first entry.
+        unsigned first;
+    };
+
+    /**
+     * Sets, smallest page size first.  4K mappings dominate stacks and
+     * guest kernels; Xen's directmap uses 1G and 2M superpages.
+     */
+    static const TLBSet tlb_sets[] =
+    {
+        { 12, 64,  0 },
+        { 21, 16, 64 },
+        { 30,  4, 80 },
+        { 39,  2, 84 },
+    };
+
+    /// Number of sets.
+    static const unsigned nr_tlb_sets = sizeof tlb_sets / sizeof tlb_sets[0];
+    /// Total number of entries across all sets.
+    static const unsigned nr_tlb_entries = 86;
+
+    /**
+     * Sets of not present ranges, indexed by level - 1.  A not present
+     * entry covers the range its level would have mapped.  Guard pages
+     * give level 1 ranges; holes in sparse address spaces give the rest.
+     */
+    static const TLBSet absent_sets[] =
+    {
+        { 12, 16, 86 },
+        { 21,  8, 102 },
+        { 30,  4, 110 },
+        { 39,  2, 114 },
+    };
+
+    /// Number of not present range sets.
+    static const unsigned nr_absent_sets = sizeof absent_sets / sizeof absent_sets[0];
+    /// Total number of entries, including not present ranges.
+    static const unsigned nr_all_entries = 116;
+
+    TLB::TLB():
+        entries(NULL), refused(false), hits(0), misses(0), absent_hits(0),
+        flushes(0)
+    {}
+
+    TLB::~TLB()
+    {
+        if ( this->entries )
+            membudget.uncharge(nr_all_entries * sizeof (Entry));
+        SAFE_DELETE_ARRAY(this->entries);
+    }
+
+    bool TLB::lookup(const vaddr_t & vaddr, maddr_t & maddr,
+                     vaddr_t * page_end, unsigned * page_shift)
+    {
+        if ( this->entries )
+        {
+            for ( unsigned s = 0; s < nr_tlb_sets; ++s )
+            {
+                const TLBSet & set = tlb_sets[s];
+                uint64_t tag = vaddr >> set.shift;
+                const Entry & e = this->entries[set.first + (tag & (set.nr - 1))];
+
+                if ( e.tag == tag )
+                {
+                    uint64_t mask = (1ULL << set.shift) - 1;
+
+                    maddr = e.base | (vaddr & mask);
+                    if ( page_end )
+                        *page_end = vaddr | mask;
+                    if ( page_shift )
+                        *page_shift = set.shift;
+
+                    ++this->hits;
+                    iostats.count_tlb_hit();
+                    return true;
+                }
+            }
+        }
+
+        ++this->misses;
+        return false;
+    }
+
+    bool TLB::allocate()
+    {
+        if ( this->entries )
+            return true;
+
+        if ( this->refused ||
+             ! membudget.charge(nr_all_entries * sizeof (Entry)) )
+        {
+            this->refused = true;
+            return false;
+        }
+
+        this->entries = new Entry[nr_all_entries];
+        for ( unsigned x = 0; x < nr_all_entries; ++x )
+            this->entries[x].tag = ~0ULL;
+        return true;
+    }
+
+    void TLB::insert(const vaddr_t & vaddr, const maddr_t & maddr,
+                     unsigned page_shift)
+    {
+        if ( ! this->allocate() )
+            return;
+
+        for ( unsigned s = 0; s < nr_tlb_sets; ++s )
+        {
+            const TLBSet & set = tlb_sets[s];
+
+            if ( set.shift != page_shift )
+                continue;
+
+            uint64_t tag = vaddr >> set.shift;
+            Entry & e = this->entries[set.first + (tag & (set.nr - 1))];
+
+            e.tag = tag;
+            e.base = maddr & ~((1ULL << set.shift) - 1);
+            return;
+        }
+    }
+
+    bool TLB::lookup_absent(const vaddr_t & vaddr, int & level,
+                            vaddr_t * range_end)
+    {
+        if ( ! this->entries )
+            return false;
+
+        // Largest range first.
+        for ( unsigned s = nr_absent_sets; s-- > 0; )
+        {
+            const TLBSet & set = absent_sets[s];
+            uint64_t tag = vaddr >> set.shift;
+
+            if ( this->entries[set.first + (tag & (set.nr - 1))].tag == tag )
+            {
+                level = s + 1;
+                if ( range_end )
+                    *range_end = vaddr | ((1ULL << set.shift) - 1);
+
+                ++this->absent_hits;
+                iostats.count_tlb_hit();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void TLB::insert_absent(const vaddr_t & vaddr, int level)
+    {
+        if ( level < 1 || level > (int)nr_absent_sets || ! this->allocate() )
+            return;
+
+        const TLBSet & set = absent_sets[level - 1];
+        uint64_t tag = vaddr >> set.shift;
+
+        this->entries[set.first + (tag & (set.nr - 1))].tag = tag;
+    }
+
+    void TLB::flush()
+    {
+        ++this->flushes;
+
+        if ( ! this->entries )
+            return;
+
+        for ( unsigned x = 0; x < nr_all_entries; ++x )
+            this->entries[x].tag = ~0ULL;
+    }
+
+    void TLB::flush(const vaddr_t & vaddr)
+    {
+        ++this->flushes;
+
+        if ( ! this->entries )
+            return;
+
+        for ( unsigned s = 0; s < nr_tlb_sets; ++s )
+        {
+            const TLBSet & set = tlb_sets[s];
+            uint64_t tag = vaddr >> set.shift;
+            Entry & e = this->entries[set.first + (tag & (set.nr - 1))];
+
+            if ( e.tag == tag )
+                e.tag = ~0ULL;
+        }
+
+        for ( unsigned s = 0; s < nr_absent_sets; ++s )
+        {
+            const TLBSet & set = absent_sets[s];
+            uint64_t tag = vaddr >> set.shift;
+            Entry & e = this->entries[set.first + (tag & (set.nr - 1))];
+
+            if ( e.tag == tag )
+                e.tag = ~0ULL;
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -33,7 +33,10 @@
 #include "abstract/xensyms.hpp"
 #include "util/print-bitwise.hpp"
 #include "host.hpp"
+#include "system.hpp"
 #include "memory.hpp"
+#include "struct-snapshot.hpp"
+#include "io-stats.hpp"
 #include "util/print-structures.hpp"
 #include "util/log.hpp"
 #include "util/macros.hpp"
@@ -47,12 +50,17 @@ namespace x86_64
 
     VCPU::VCPU(Abstract::VCPU::VCPURunstate rst):
         Abstract::VCPU(rst), arch_flags(0), guest_table_user(0),
-        guest_table(0), regs()
+        guest_table(0), hvm_guest_cr0(0), hvm_guest_cr3(0), hvm_guest_efer(0),
+        p2m_table(0), regs()
     {
         memset(&this->regs, 0, sizeof this->regs);
     }
 
-    VCPU::~VCPU(){}
+    VCPU::~VCPU()
+    {
+        host.ptregistry.put(this->dompt);
+        this->dompt = NULL;
+    }
 
     bool VCPU::parse_basic(const vaddr_t & addr, const Abstract::PageTable & xenpt)
     {
@@ -67,27 +75,37 @@ namespace x86_64
             host.validate_xen_vaddr(addr);
             this->vcpu_ptr = addr;
 
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_domain,
-                                this->domain_ptr);
+            StructSnapshot vcpu;
+            vcpu.read(xenpt, this->vcpu_ptr, VCPU_sizeof);
+
+            vcpu.get(VCPU_domain, this->domain_ptr);
 
             host.validate_xen_vaddr(this->domain_ptr);
 
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_vcpu_id,
-                                this->vcpu_id);
+            vcpu.get(VCPU_vcpu_id, this->vcpu_id);
+            vcpu.get(VCPU_processor, this->processor);
 
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_processor,
-                                this->processor);
+            vcpu.get(VCPU_pause_flags, this->pause_flags);
+            vcpu.get(VCPU_pause_count, this->pause_count);
 
-            memory.read16_vaddr(xenpt, this->domain_ptr + DOMAIN_id,
-                                this->domid);
+            vcpu.get(VCPU_flags, this->arch_flags);
+            vcpu.get(VCPU_guest_table_user, this->guest_table_user);
+            vcpu.get(VCPU_guest_table, this->guest_table);
+            vcpu.get(VCPU_cr3, this->regs.cr3);
 
+            // Only three fields of struct domain are needed; don't snapshot it.
+            ReadBatch batch;
             uint8_t is_32bit;
-            memory.read8_vaddr(xenpt, this->domain_ptr + DOMAIN_is_32bit_pv,
-                               is_32bit);
+            uint32_t paging_mode;
+
+            batch.add(this->domain_ptr + DOMAIN_id, this->domid);
+            batch.add(this->domain_ptr + DOMAIN_is_32bit_pv, is_32bit);
+            batch.add(this->domain_ptr + DOMAIN_paging_mode, paging_mode);
+
+            memory.read_batch_vaddr(xenpt, batch);
+
             this->flags |= is_32bit ? CPU_PV_COMPAT : 0;
 
-            uint32_t paging_mode;
-            memory.read32_vaddr(xenpt, this->domain_ptr + DOMAIN_paging_mode, paging_mode);
             if ( paging_mode == 0 )
                 this->paging_support = VCPU::PAGING_NONE;
             else if ( paging_mode & (1U<<20) )
@@ -95,21 +113,12 @@ namespace x86_64
             else if ( paging_mode & (1U<<21) )
                 this->paging_support = VCPU::PAGING_HAP;
 
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_pause_flags,
-                                this->pause_flags);
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_pause_count,
-                                this->pause_count);
+            if ( this->paging_support == VCPU::PAGING_HAP &&
+                 HAVE_x86_64_XENSYMS(x86_64_hap) )
+                this->parse_hap(vcpu, xenpt);
 
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_flags,
-                                this->arch_flags);
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_guest_table_user,
-                                this->guest_table_user);
             this->guest_table_user = this->guest_table_user << PAGE_SHIFT;
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_guest_table,
-                                this->guest_table);
             this->guest_table = this->guest_table << PAGE_SHIFT;
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_cr3,
-                                this->regs.cr3);
 
             this->flags |= CPU_CR_REGS;
 
@@ -128,16 +137,22 @@ namespace x86_64
     {
         try
         {
-            if ( this->guest_table == 0ULL )
+            // HAP guests have no guest_table; their own cr3 is walked instead.
+            if ( this->paging_support == VCPU::PAGING_HAP &&
+                 (this->dompt = this->new_hap_pagetable(*this)) )
+                this->flags |= CPU_NESTED_PT;
+            else
             {
-                LOG_WARN("Cannot get kernel page table address - VCPU assumed down\n");
-                return false;
-            }
+                if ( this->guest_table == 0ULL )
+                {
+                    LOG_WARN("Cannot get kernel page table address - VCPU assumed down\n");
+                    return false;
+                }
 
-            if ( this->flags & CPU_PV_COMPAT )
-                this->dompt = new x86_64::PT64Compat(this->guest_table);
-            else
-                this->dompt = new x86_64::PT64(this->guest_table);
+                this->dompt = host.ptregistry.get(
+                    this->guest_table, (this->flags & CPU_PV_COMPAT) ?
+                    PageTableRegistry::MODE_COMPAT : PageTableRegistry::MODE_64);
+            }
 
             switch ( this->runstate )
             {
@@ -273,19 +288,25 @@ namespace x86_64
     {
         // Dangerous, but safe.  We will only actually be handed a 64bit vcpu;
         const VCPU * vcpu = reinterpret_cast<const VCPU *>(active);
+        bool nested = false;
 
         try
         {
-            if ( vcpu->guest_table == 0ULL )
+            if ( vcpu->paging_support == VCPU::PAGING_HAP &&
+                 (this->dompt = this->new_hap_pagetable(*vcpu)) )
+                nested = true;
+            else
             {
-                LOG_ERROR("Cannot get kernel page table address from active VCPU\n");
-                return false;
-            }
+                if ( vcpu->guest_table == 0ULL )
+                {
+                    LOG_ERROR("Cannot get kernel page table address from active VCPU\n");
+                    return false;
+                }
 
-            if ( this->flags & CPU_PV_COMPAT )
-                this->dompt = new x86_64::PT64Compat(vcpu->guest_table);
-            else
-                this->dompt = new x86_64::PT64(vcpu->guest_table);
+                this->dompt = host.ptregistry.get(
+                    vcpu->guest_table, (this->flags & CPU_PV_COMPAT) ?
+                    PageTableRegistry::MODE_COMPAT : PageTableRegistry::MODE_64);
+            }
         }
         catch ( const std::bad_alloc & )
         {
@@ -298,15 +319,71 @@ namespace x86_64
             return false;
         }
 
-        this->flags = vcpu->flags;
+        this->flags = nested ? (vcpu->flags | CPU_NESTED_PT) :
+            (vcpu->flags & ~CPU_NESTED_PT);
         this->regs = vcpu->regs;
         this->runstate = vcpu->runstate;
         this->arch_flags = vcpu->arch_flags;
         this->guest_table_user = vcpu->guest_table_user;
         this->guest_table = vcpu->guest_table;
+        this->hvm_guest_cr0 = vcpu->hvm_guest_cr0;
+        this->hvm_guest_cr3 = vcpu->hvm_guest_cr3;
+        this->hvm_guest_efer = vcpu->hvm_guest_efer;
+        this->p2m_table = vcpu->p2m_table;
         return true;
     }
 
+    bool VCPU::parse_hap(const StructSnapshot & vcpu, const Abstract::PageTable & xenpt)
+    {
+        try
+        {
+            vaddr_t p2m;
+            uint64_t phys_table;
+
+            vcpu.get(VCPU_hvm_guest_cr, this->hvm_guest_cr0);
+            vcpu.get(VCPU_hvm_guest_cr + 3 * sizeof (uint64_t), this->hvm_guest_cr3);
+            vcpu.get(VCPU_hvm_guest_efer, this->hvm_guest_efer);
+
+            memory.read64_vaddr(xenpt, this->domain_ptr + DOMAIN_p2m, p2m);
+            host.validate_xen_vaddr(p2m);
+            memory.read64_vaddr(xenpt, p2m + P2M_phys_table, phys_table);
+
+            this->p2m_table = phys_table << PAGE_SHIFT;
+            return true;
+        }
+        catch ( const CommonError & e )
+        {
+            e.log();
+        }
+
+        return false;
+    }
+
+    Abstract::PageTable * VCPU::new_hap_pagetable(const VCPU & src) const
+    {
+        bool paging = src.hvm_guest_cr0 & X86_CR0_PG;
+
+        if ( src.p2m_table == 0ULL )
+            return NULL;
+
+        if ( paging && ! (src.hvm_guest_efer & EFER_LMA) )
+        {
+            LOG_INFO("d%"PRIu16"v%"PRIu32" is not in long mode - cannot walk its "
+                     "pagetables\n", this->domid, this->vcpu_id);
+            return NULL;
+        }
+
+        if ( cpu_vendor == VENDOR_UNKNOWN )
+        {
+            LOG_INFO("Unknown CPU vendor - cannot tell whether d%"PRIu16
+                     " uses EPT or NPT\n", this->domid);
+            return NULL;
+        }
+
+        return new x86_64::HAPPT(src.p2m_table, cpu_vendor == VENDOR_INTEL,
+                                 src.hvm_guest_cr3, paging);
+    }
+
 
     bool VCPU::is_online() const { return ! (this->pause_flags & 0x2); }
 
@@ -398,11 +475,15 @@ namespace x86_64
 
         len += FPUTS("\n", o);
 
+        /* TF_kernel_mode is PV only.  A HAP guest's stack is in its own
+         * address space whichever mode it is in. */
         if ( this->flags & CPU_GP_REGS &&
              this->flags & CPU_CR_REGS &&
-             this->arch_flags & TF_kernel_mode &&
-             ( this->paging_support == VCPU::PAGING_NONE ||
-               this->paging_support == VCPU::PAGING_SHADOW )
+             ( ( this->arch_flags & TF_kernel_mode &&
+                 ( this->paging_support == VCPU::PAGING_NONE ||
+                   this->paging_support == VCPU::PAGING_SHADOW ) ) ||
+               ( this->paging_support == VCPU::PAGING_HAP &&
+                 this->flags & CPU_NESTED_PT ) )
             )
         {
             len += FPRINTF(o, "\tStack at %16"PRIx64":", this->regs.rsp);
@@ -417,6 +498,7 @@ namespace x86_64
                 vaddr_t sp = this->regs.rsp;
                 vaddr_t top = (this->regs.rsp | (PAGE_SIZE-1))+1;
                 uint64_t val;
+                IOStatScope stat_scope(IOSTAT_STACK);
 
                 len += host.dom0_symtab.print_symbol64(o, this->regs.rip, true);
 
@@ -533,6 +615,7 @@ namespace x86_64
                 vaddr_t sp = this->regs.rsp;
                 vaddr_t top = (this->regs.rsp | (PAGE_SIZE-1))+1;
                 union { uint32_t val32; uint64_t val64; } val;
+                IOStatScope stat_scope(IOSTAT_STACK);
                 val.val64 = 0;
 
                 len += host.dom0_symtab.print_symbol32(o, this->regs.rip, true);
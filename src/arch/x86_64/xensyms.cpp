@@ -39,6 +39,8 @@ namespace xensyms
 
     vaddr_t DOMAIN_paging_mode, DOMAIN_is_32bit_pv;
 
+    vaddr_t VCPU_hvm_guest_cr, VCPU_hvm_guest_efer, DOMAIN_p2m, P2M_phys_table;
+
     vaddr_t per_cpu__curr_vcpu, __per_cpu_offset, stack_base;
 
     /// @cond EXCLUDE
@@ -47,6 +49,7 @@ namespace xensyms
     DEFINE_XENSYM_GROUP(x86_64_vcpu);
     DEFINE_XENSYM_GROUP(x86_64_domain);
     DEFINE_XENSYM_GROUP(x86_64_per_cpu);
+    DEFINE_XENSYM_GROUP(x86_64_hap);
     /// @endcond
 
     const struct xensym xensyms [] =
@@ -72,6 +75,11 @@ namespace xensyms
         XENSYM(x86_64_per_cpu, __per_cpu_offset),
         XENSYM(x86_64_per_cpu, stack_base),
 
+        XENSYM(x86_64_hap, VCPU_hvm_guest_cr),
+        XENSYM(x86_64_hap, VCPU_hvm_guest_efer),
+        XENSYM(x86_64_hap, DOMAIN_p2m),
+        XENSYM(x86_64_hap, P2M_phys_table),
+
         XENSYM_NULL
     };
 }
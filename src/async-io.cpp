@@ -0,0 +1,367 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "async-io.hpp"
+#include "util/log.hpp"
+
+#ifndef _LARGEFILE64_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <cstring>
+#include <deque>
+#include <algorithm>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/**
+ * @file src/async-io.cpp
+ */
+
+/// Upper bound on the number of reader threads.
+static const unsigned MAX_THREADS = 32;
+
+/**
+ * Asynchronous reads using a pool of threads calling preadv().
+ */
+class ThreadPoolIO : public AsyncIO
+{
+public:
+    /// Constructor.
+    ThreadPoolIO();
+    /// Destructor.
+    virtual ~ThreadPoolIO();
+
+    /**
+     * Start the worker threads.
+     * @param nr Number of threads.
+     * @returns boolean indicating whether at least one thread started.
+     */
+    bool start(unsigned nr);
+
+    virtual void read_all(std::vector<Request> & reqs);
+    virtual const char * name() const { return "thread pool"; }
+
+protected:
+    /**
+     * Worker thread entry point.
+     * @param arg ThreadPoolIO instance.
+     * @returns NULL.
+     */
+    static void * worker(void * arg);
+
+    /// Worker threads.
+    std::vector<pthread_t> threads;
+    /// Reads waiting for a worker.
+    std::deque<Request *> queue;
+    /// Reads submitted but not yet completed.
+    size_t outstanding;
+    /// Whether the workers should exit.
+    bool stopping;
+
+    /// Serialises callers of read_all().
+    pthread_mutex_t submit_lock;
+    /// Protects queue, outstanding and stopping.
+    pthread_mutex_t lock;
+    /// Signalled when reads are queued, or on shutdown.
+    pthread_cond_t work;
+    /// Signalled when outstanding drops to zero.
+    pthread_cond_t done;
+
+private:
+    // @cond EXCLUDE
+    ThreadPoolIO(const ThreadPoolIO &);
+    ThreadPoolIO & operator= (const ThreadPoolIO &);
+    // @endcond
+};
+
+ThreadPoolIO::ThreadPoolIO():
+    threads(), queue(), outstanding(0), stopping(false),
+    submit_lock(), lock(), work(), done()
+{
+    pthread_mutex_init(&this->submit_lock, NULL);
+    pthread_mutex_init(&this->lock, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->done, NULL);
+}
+
+ThreadPoolIO::~ThreadPoolIO()
+{
+    pthread_mutex_lock(&this->lock);
+    this->stopping = true;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->lock);
+
+    for ( std::vector<pthread_t>::iterator it = this->threads.begin();
+          it != this->threads.end(); ++it )
+        pthread_join(*it, NULL);
+
+    pthread_cond_destroy(&this->done);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->lock);
+    pthread_mutex_destroy(&this->submit_lock);
+}
+
+bool ThreadPoolIO::start(unsigned nr)
+{
+    for ( unsigned x = 0; x < nr; ++x )
+    {
+        pthread_t t;
+        int err = pthread_create(&t, NULL, ThreadPoolIO::worker, this);
+
+        if ( err )
+        {
+            LOG_WARN("Failed to start reader thread: %s\n", strerror(err));
+            break;
+        }
+        this->threads.push_back(t);
+    }
+
+    return this->threads.size() > 0;
+}
+
+void ThreadPoolIO::read_all(std::vector<Request> & reqs)
+{
+    pthread_mutex_lock(&this->submit_lock);
+    pthread_mutex_lock(&this->lock);
+
+    for ( std::vector<Request>::iterator it = reqs.begin(); it != reqs.end(); ++it )
+        this->queue.push_back(&*it);
+    this->outstanding += reqs.size();
+    pthread_cond_broadcast(&this->work);
+
+    while ( this->outstanding )
+        pthread_cond_wait(&this->done, &this->lock);
+
+    pthread_mutex_unlock(&this->lock);
+    pthread_mutex_unlock(&this->submit_lock);
+}
+
+void * ThreadPoolIO::worker(void * arg)
+{
+    ThreadPoolIO * self = static_cast<ThreadPoolIO *>(arg);
+
+    pthread_mutex_lock(&self->lock);
+
+    for ( ;; )
+    {
+        while ( ! self->stopping && self->queue.empty() )
+            pthread_cond_wait(&self->work, &self->lock);
+
+        if ( self->queue.empty() )
+            break;
+
+        Request * r = self->queue.front();
+        self->queue.pop_front();
+        pthread_mutex_unlock(&self->lock);
+
+        do
+            r->result = preadv64(r->fd, r->iov, r->iovcnt, r->offset);
+        while ( r->result == -1 && errno == EINTR );
+
+        if ( r->result == -1 )
+            r->result = -errno;
+
+        pthread_mutex_lock(&self->lock);
+        if ( --self->outstanding == 0 )
+            pthread_cond_signal(&self->done);
+    }
+
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * Asynchronous reads using io_uring.
+ */
+class UringIO : public AsyncIO
+{
+public:
+    /**
+     * Constructor.
+     * @param depth Submission queue depth.
+     */
+    UringIO(unsigned depth);
+    /// Destructor.
+    virtual ~UringIO();
+
+    /**
+     * Set up the ring.
+     * @returns boolean indicating success.
+     */
+    bool init();
+
+    virtual void read_all(std::vector<Request> & reqs);
+    virtual const char * name() const { return "io_uring"; }
+
+protected:
+    /// Submission queue depth.
+    unsigned depth;
+    /// Whether ring has been set up.
+    bool initialised;
+    /// The ring.
+    struct io_uring ring;
+    /// Serialises callers of read_all().
+    pthread_mutex_t lock;
+
+private:
+    // @cond EXCLUDE
+    UringIO(const UringIO &);
+    UringIO & operator= (const UringIO &);
+    // @endcond
+};
+
+UringIO::UringIO(unsigned depth):
+    depth(depth), initialised(false), ring(), lock()
+{
+    pthread_mutex_init(&this->lock, NULL);
+}
+
+UringIO::~UringIO()
+{
+    if ( this->initialised )
+        io_uring_queue_exit(&this->ring);
+    pthread_mutex_destroy(&this->lock);
+}
+
+bool UringIO::init()
+{
+    int err = io_uring_queue_init(this->depth, &this->ring, 0);
+
+    if ( err < 0 )
+    {
+        LOG_INFO("io_uring unavailable: %s\n", strerror(-err));
+        return false;
+    }
+
+    this->initialised = true;
+    return true;
+}
+
+void UringIO::read_all(std::vector<Request> & reqs)
+{
+    size_t submitted = 0, completed = 0, inflight = 0;
+    std::vector<bool> done(reqs.size(), false);
+    int err = 0;
+
+    pthread_mutex_lock(&this->lock);
+
+    if ( ! this->initialised )
+        err = -EIO;
+
+    while ( ! err && completed < reqs.size() )
+    {
+        while ( submitted < reqs.size() && inflight < this->depth )
+        {
+            struct io_uring_sqe * sqe = io_uring_get_sqe(&this->ring);
+
+            if ( ! sqe )
+                break;
+
+            Request & r = reqs[submitted++];
+            io_uring_prep_readv(sqe, r.fd, r.iov, r.iovcnt, r.offset);
+            io_uring_sqe_set_data(sqe, &r);
+            ++inflight;
+        }
+
+        int ret = io_uring_submit(&this->ring);
+        if ( ret == -EINTR || ret == -EAGAIN )
+            continue;
+        if ( ret < 0 )
+        {
+            err = ret;
+            break;
+        }
+
+        struct io_uring_cqe * cqe;
+        ret = io_uring_wait_cqe(&this->ring, &cqe);
+        if ( ret == -EINTR || ret == -EAGAIN )
+            continue;
+        if ( ret < 0 )
+        {
+            err = ret;
+            break;
+        }
+
+        Request * r = static_cast<Request *>(io_uring_cqe_get_data(cqe));
+        r->result = cqe->res;
+        done[r - &reqs[0]] = true;
+        io_uring_cqe_seen(&this->ring, cqe);
+        --inflight;
+        ++completed;
+    }
+
+    if ( err )
+    {
+        for ( size_t x = 0; x < reqs.size(); ++x )
+            if ( ! done[x] )
+                reqs[x].result = err;
+
+        /* Requests may still be queued or in flight.  Abandon the ring
+         * rather than reap their completions in a later call. */
+        if ( this->initialised )
+        {
+            LOG_ERROR("io_uring failed: %s.  No further asynchronous reads\n",
+                      strerror(-err));
+            io_uring_queue_exit(&this->ring);
+            this->initialised = false;
+        }
+    }
+
+    pthread_mutex_unlock(&this->lock);
+}
+#endif
+
+AsyncIO * AsyncIO::create(unsigned depth)
+{
+    if ( ! depth )
+        return NULL;
+
+#ifdef HAVE_LIBURING
+    UringIO * uring = new UringIO(depth);
+    if ( uring->init() )
+        return uring;
+    delete uring;
+#endif
+
+    ThreadPoolIO * pool = new ThreadPoolIO();
+    if ( pool->start(std::min(depth, MAX_THREADS)) )
+        return pool;
+    delete pool;
+
+    return NULL;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -28,8 +28,12 @@
 
 #include "util/log.hpp"
 #include "exceptions.hpp"
+#include "io-stats.hpp"
 
-CommonError::CommonError() throw() {}
+CommonError::CommonError() throw()
+{
+    iostats.count_exception();
+}
 CommonError::~CommonError() throw() {}
 
 memseek::memseek(const maddr_t & addr, const int64_t & offset) throw():
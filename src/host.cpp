@@ -38,6 +38,8 @@
 #include "util/print-structures.hpp"
 #include "util/log.hpp"
 #include "memory.hpp"
+#include "io-stats.hpp"
+#include "mem-budget.hpp"
 #include "util/file.hpp"
 #include "util/macros.hpp"
 #include "util/stdio-wrapper.hpp"
@@ -62,8 +64,9 @@ Host::Host():
     xen_major(0), xen_minor(0), xen_extra(NULL),
     xen_changeset(NULL), xen_compiler(NULL),
     xen_compile_date(NULL), debug_build(false),
-    can_validate_xen_vaddr(false), xen_vmcoreinfo(), dom0_vmcoreinfo(),
-    payloads(), applied_payloads()
+    can_validate_xen_vaddr(false), verify_directmap(false),
+    xen_vmcoreinfo(), dom0_vmcoreinfo(), rmap(), ptregistry(), payloads(),
+    applied_payloads()
 {}
 
 Host::~Host()
@@ -121,6 +124,10 @@ bool Host::setup(const Abstract::Elf * elf)
         this->idle_vcpus = new vaddr_t[nr_pcpus];
         this->pcpu_stacks = new vaddr_t[nr_pcpus];
 
+        membudget.charge_required(nr_pcpus * ( sizeof (Abstract::PCPU*) +
+                                               sizeof (x86_64::PCPU) +
+                                               2 * sizeof (vaddr_t) ));
+
         for ( int x = 0; x < nr_pcpus; ++x )
             this->idle_vcpus[x] = this->pcpu_stacks[x] = -((vaddr_t)1);
     }
@@ -222,6 +229,8 @@ bool Host::parse_crash_xen_info(const char * buff, const size_t len)
 
 bool Host::decode_xen()
 {
+    IOStatScope stat_scope(IOSTAT_XEN);
+
     LOG_INFO("Decoding physical CPU information.  %d PCPUs\n", this->nr_pcpus);
 
     if ( ! ( REQ_x86_64_XENSYMS(x86_64_per_cpu) &
@@ -238,17 +247,20 @@ bool Host::decode_xen()
 
         if ( this->arch == Abstract::Elf::ELF_64 )
         {
+            ReadBatch batch;
+
             LOG_DEBUG("  Reading per-pcpu information\n");
             for ( int x = 0; x < this->nr_pcpus; ++x )
             {
                 vaddr_t idle = idle_vcpu + (x * sizeof(uint64_t) );
                 host.validate_xen_vaddr(idle);
-                memory.read64_vaddr(xenpt, idle, this->idle_vcpus[x]);
+                batch.add(idle, this->idle_vcpus[x]);
 
                 vaddr_t stack = stack_base + (x * sizeof(uint64_t));
                 host.validate_xen_vaddr(stack);
-                memory.read64_vaddr(xenpt, stack, this->pcpu_stacks[x]);
+                batch.add(stack, this->pcpu_stacks[x]);
             }
+            memory.read_batch_vaddr(xenpt, batch);
         }
         else
         {
@@ -272,6 +284,11 @@ bool Host::decode_xen()
                 LOG_WARN("  Failed to decode extended state for pcpu%d\n", x);
         }
 
+        for (int x=0; x < nr_pcpus; ++x)
+            if ( this->pcpus[x]->xenpt )
+                this->rmap.add_root(this->pcpus[x]->xenpt->root(), ~0ULL,
+                                    "xen pcpu%d", x);
+
         this->active_vcpus.reserve(nr_pcpus);
         LOG_DEBUG("  Generating active vcpu list\n");
 
@@ -311,6 +328,7 @@ bool Host::decode_xen()
 
 bool Host::decode_payloads()
 {
+    IOStatScope stat_scope(IOSTAT_PAYLOAD);
     const Abstract::PageTable & xenpt = this->get_xenpt();
 
     if ( this->arch != Abstract::Elf::ELF_64 )
@@ -357,7 +375,10 @@ bool Host::decode_payloads()
             payload->decode_state();
 
             // Failure to decode the symbol table is not a critical error.
-            payload->decode_symbol_table(symtab);
+            if ( membudget.pressure() )
+                LOG_WARN("Memory pressure.  Skipping symbol table for payload\n");
+            else
+                payload->decode_symbol_table(symtab);
 
             payloads.push_back(payload);
 
@@ -412,6 +433,7 @@ bool Host::decode_payloads()
 
 int Host::print_payloads(FILE *o)
 {
+    IOStatScope stat_scope(IOSTAT_PAYLOAD);
     int len = 0;
 
     len += FPUTS("Loaded payloads:\n", o);
@@ -430,6 +452,7 @@ int Host::print_payloads(FILE *o)
 
 bool Host::print_xen(bool dump_structures)
 {
+    IOStatScope stat_scope(IOSTAT_XEN);
     static const char * xen_log_file = "xen.log";
     int len = 0;
     bool success = false;
@@ -592,6 +615,7 @@ bool Host::print_xen(bool dump_structures)
 
 int Host::print_domains(bool dump_structures)
 {
+    IOStatScope stat_scope(IOSTAT_DOMAIN);
     int success = 0;
 
     LOG_INFO("Decoding Domains\n");
@@ -692,6 +716,17 @@ int Host::print_domains(bool dump_structures)
                     dom->vcpus[v]->runstate = Abstract::VCPU::RST_NONE;
                     dom->vcpus[v]->parse_extended(xenpt);
                 }
+
+                /* HVM guest pagetables are in guest physical address space,
+                 * so can't be enumerated from here. */
+                const Abstract::VCPU * vcpu = dom->vcpus[v];
+                if ( vcpu->dompt &&
+                     ! (vcpu->flags & (Abstract::VCPU::CPU_HVM |
+                                       Abstract::VCPU::CPU_NESTED_PT)) )
+                    this->rmap.add_root(vcpu->dompt->root(),
+                                        (vcpu->flags & Abstract::VCPU::CPU_PV_COMPAT) ?
+                                        0xffffffffULL : ~0ULL,
+                                        "d%"PRIu16" v%"PRIu32, dom->domain_id, v);
             }
 
             try
@@ -706,28 +741,34 @@ int Host::print_domains(bool dump_structures)
             // We are going to dump the xen structures...
             if ( dump_structures )
             {
-                // so start off by cleaning up
-                set_additional_log(NULL);
-                SAFE_FCLOSE(fd);
-
-                // and open up some newer files
-                snprintf(fname, sizeof fname, "dom%d.structures.log", dom->domain_id);
-                if ( ! (fd = fopen_in_outdir(fname, "w")) )
+                if ( membudget.pressure() )
+                    LOG_WARN("    Memory pressure.  Not dumping structures\n");
+                else
                 {
-                    LOG_ERROR("    Failed to open file '%s' in output directory\n",
-                              fname);
-                    goto loop_cont;
-                }
-                LOG_DEBUG("    Dumping structures to '%s'\n", fname);
-                set_additional_log(fd);
+                    // so start off by cleaning up
+                    set_additional_log(NULL);
+                    SAFE_FCLOSE(fd);
+
+                    // and open up some newer files
+                    snprintf(fname, sizeof fname, "dom%d.structures.log",
+                             dom->domain_id);
+                    if ( ! (fd = fopen_in_outdir(fname, "w")) )
+                    {
+                        LOG_ERROR("    Failed to open file '%s' in output directory\n",
+                                  fname);
+                        goto loop_cont;
+                    }
+                    LOG_DEBUG("    Dumping structures to '%s'\n", fname);
+                    set_additional_log(fd);
 
-                try
-                {
-                    dom->dump_structures(fd);
-                }
-                catch ( const filewrite & e )
-                {
-                    e.log(fname);
+                    try
+                    {
+                        dom->dump_structures(fd);
+                    }
+                    catch ( const filewrite & e )
+                    {
+                        e.log(fname);
+                    }
                 }
             }
 
@@ -786,6 +827,30 @@ const Abstract::PageTable & Host::get_xenpt() const
     throw validate(0, "No suitable PCPU Xen pagetables.");
 }
 
+bool Host::print_reverse_map(const std::vector<uint64_t> & mfns)
+{
+    std::vector<x86_64::ReverseMap::Hit> hits;
+
+    LOG_INFO("Reverse mapping %zu frames over %zu pagetables\n", mfns.size(),
+             this->rmap.nr_roots());
+
+    if ( ! this->rmap.build() )
+        return false;
+
+    for ( std::vector<uint64_t>::const_iterator it = mfns.begin();
+          it != mfns.end(); ++it )
+    {
+        this->rmap.lookup(*it, hits);
+
+        LOG_INFO("  mfn 0x%"PRIx64": %zu mappings\n", *it, hits.size());
+        for ( size_t x = 0; x < hits.size(); ++x )
+            LOG_INFO("    %-16s cr3 0x%016"PRIx64" vaddr 0x%016"PRIx64"\n",
+                     hits[x].label, hits[x].cr3, hits[x].vaddr);
+    }
+
+    return true;
+}
+
 bool Host::parse_vmcoreinfo(const ElfNote& note)
 {
     /* N.B. Both Xen and dom0 vmcoreinfo ELF notes use the same
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "io-stats.hpp"
+#include "util/log.hpp"
+
+#include <cstring>
+
+/**
+ * @file src/io-stats.cpp
+ */
+
+/// Caller tag names, indexed by IOStatTag.
+static const char * tag_names[IOSTAT_NR] =
+{
+    "other", "xen", "domain", "stack", "console", "payload"
+};
+
+__thread IOStatTag IOStats::current = IOSTAT_OTHER;
+
+IOStats::IOStats():
+    enabled(false)
+{
+    std::memset(this->counters, 0, sizeof this->counters);
+}
+
+void IOStats::log() const
+{
+    char line[256];
+    int len, x, b, last = 0;
+
+    if ( ! this->enabled )
+        return;
+
+    LOG_INFO("I/O statistics:\n");
+    LOG_INFO("  %-8s %10s %12s %10s %10s %10s %10s %10s\n", "Caller", "Reads",
+             "Bytes", "Lookups", "Walks", "PT reads", "TLB hits", "Errors");
+
+    for ( x = 0; x < IOSTAT_NR; ++x )
+    {
+        const Counters & c = this->counters[x];
+
+        LOG_INFO("  %-8s %10"PRIu64" %12"PRIu64" %10"PRIu64" %10"PRIu64
+                 " %10"PRIu64" %10"PRIu64" %10"PRIu64"\n", tag_names[x],
+                 c.reads, c.bytes, c.lookups, c.walks, c.pt_reads,
+                 c.tlb_hits, c.exceptions);
+
+        for ( b = 0; b < IOSTAT_HIST_BUCKETS; ++b )
+            if ( c.hist[b] && b > last )
+                last = b;
+    }
+
+    LOG_INFO("Read size histogram:\n");
+
+    len = snprintf(line, sizeof line, "  %-12s", "Bytes");
+    for ( x = 0; x < IOSTAT_NR; ++x )
+        len += snprintf(line + len, sizeof line - len, " %9s", tag_names[x]);
+    LOG_INFO("%s\n", line);
+
+    for ( b = 0; b <= last; ++b )
+    {
+        if ( b == 0 )
+            len = snprintf(line, sizeof line, "  %-12s", "0");
+        else
+        {
+            char range[32];
+
+            snprintf(range, sizeof range, "%llu-%llu", 1ULL << (b-1),
+                     (1ULL << b) - 1);
+            len = snprintf(line, sizeof line, "  %-12s", range);
+        }
+
+        for ( x = 0; x < IOSTAT_NR; ++x )
+            len += snprintf(line + len, sizeof line - len, " %9"PRIu64,
+                            this->counters[x].hist[b]);
+        LOG_INFO("%s\n", line);
+    }
+}
+
+/// I/O statistics
+IOStats iostats;
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,8 +20,12 @@
 
 #include "util/log.hpp"
 #include "util/macros.hpp"
+#include "util/misc.hpp"
 #include "host.hpp"
 #include "memory.hpp"
+#include "io-stats.hpp"
+#include "pte-cache.hpp"
+#include "mem-budget.hpp"
 #include "system.hpp"
 #include "abstract/elf.hpp"
 #include "abstract/xensyms.hpp"
@@ -78,6 +82,15 @@ const static struct option long_options[] =
 
     // Additional debugging options
     { "dump-structures", no_argument, NULL, 0x101 },
+    { "no-mmap", no_argument, NULL, 0x102 },
+    { "page-cache", required_argument, NULL, 0x103 },
+    { "async-io", required_argument, NULL, 0x104 },
+    { "stats", no_argument, NULL, 0x105 },
+    { "mem-limit", required_argument, NULL, 0x106 },
+    { "mini-core", required_argument, NULL, 0x107 },
+    { "direct-io", no_argument, NULL, 0x108 },
+    { "verify-directmap", no_argument, NULL, 0x109 },
+    { "rmap", required_argument, NULL, 0x10a },
 
     // EoL
     { NULL, 0, NULL, 0 }
@@ -88,8 +101,8 @@ static const char *xen_symtab_path;
 static const char *dom0_symtab_path;
 /// Default CORE crash file path.
 static const char default_core_path[] = "/proc/vmcore";
-/// Path to the CORE crash file.
-static const char * core_path = default_core_path;
+/// Paths to the CORE crash files.  One, unless the crash was split.
+static std::vector<const char *> core_paths;
 /// Log file path.
 static const char * log_path = "xen-crashdump-analyser.log";
 /// Path to the output directory
@@ -102,6 +115,10 @@ static int workdirfd = 0;
 static FILE * logfd = stderr;
 /// Should we dump the Xen structures ?
 static bool dump_structures = false;
+/// Path to write a mini core of the frames read, if any.
+static const char * mini_core_path = NULL;
+/// Machine frames to reverse map.
+static std::vector<uint64_t> rmap_mfns;
 
 /**
  * Convert a severity value to string
@@ -206,6 +223,15 @@ void atexit_close_log( void )
     sync();
 }
 
+/// Atexit function to log memory statistics, before the log is closed
+void atexit_memory_stats( void )
+{
+    memory.log_stats();
+    ptecache.log();
+    iostats.log();
+    membudget.log();
+}
+
 FILE * fopen_in_outdir(const char * path, const char * flags)
 {
     FILE * fd = NULL;
@@ -280,7 +306,7 @@ static void usage(char * argv0, FILE * stream = stdout)
 #define LS_OPT(l,s,d) fprintf(stream, "    --%-*s -%c   %s\n", WL, l, s, d);
 
     fputs("Files:\n", stream);
-    LS_OPT("core", 'c', "Core crash file.  Defaults to /proc/vmcore.");
+    LS_OPT("core", 'c', "Core crash file.  Defaults to /proc/vmcore.  Repeat for each file of a split core.");
     LS_REQ("xen-symtab", 'x', "Xen Symbol Table file.");
     LS_REQ("dom0-symtab", 'd', "Dom0 Symbol Table file.");
     putc('\n', stream);
@@ -298,6 +324,15 @@ static void usage(char * argv0, FILE * stream = stdout)
 
     fputs("Debugging:\n", stream);
     L_OPT("dump-structures", "Hex dump key structures.");
+    L_OPT("no-mmap", "Read the core file with read() rather than mmap().");
+    L_OPT("page-cache=SIZE", "Page cache budget, with K/M/G suffix.  0 disables.  Defaults to 4M.");
+    L_OPT("stats", "Log I/O statistics and a histogram of read sizes.");
+    L_OPT("mem-limit=SIZE", "Memory budget, with K/M/G suffix.  Defaults to half of MemAvailable.");
+    L_OPT("async-io=DEPTH", "Keep up to DEPTH core file reads in flight.  Defaults to 0 (off).");
+    L_OPT("direct-io", "Read the core file with O_DIRECT, bypassing the kernel page cache.");
+    L_OPT("mini-core=FILE", "Write the frames read during analysis to FILE as a new core.");
+    L_OPT("verify-directmap", "Check every Xen direct map translation with a pagetable walk.");
+    L_OPT("rmap=MFN", "Log the virtual addresses mapping machine frame MFN.  May be repeated.");
     putc('\n', stream);
 
 #undef L_REQ
@@ -345,8 +380,8 @@ static bool parse_commandline(int argc, char ** argv)
             return false;
             break;
 
-        case 'c': // CORE crash file
-            core_path = optarg;
+        case 'c': // CORE crash file, possibly one of a split set
+            core_paths.push_back(optarg);
             break;
 
         case 'o': // output directory
@@ -378,6 +413,81 @@ static bool parse_commandline(int argc, char ** argv)
             dump_structures = true;
             break;
 
+        case 0x102: // Don't mmap() the core file
+            memory.use_mmap = false;
+            break;
+
+        case 0x103: // Page cache budget
+        {
+            size_t budget;
+
+            if ( ! parse_size(optarg, budget) )
+            {
+                printf("Invalid page cache size '%s'\n", optarg);
+                return false;
+            }
+            memory.set_cache_budget(budget);
+            break;
+        }
+
+        case 0x104: // Asynchronous read depth
+        {
+            char * end = NULL;
+            unsigned long depth = strtoul(optarg, &end, 0);
+
+            if ( end == optarg || *end || depth > 4096 )
+            {
+                printf("Invalid asynchronous I/O depth '%s'\n", optarg);
+                return false;
+            }
+            memory.set_async_depth((unsigned)depth);
+            break;
+        }
+
+        case 0x105: // I/O statistics
+            iostats.enabled = true;
+            break;
+
+        case 0x106: // Memory budget
+        {
+            size_t limit;
+
+            if ( ! parse_size(optarg, limit) )
+            {
+                printf("Invalid memory limit '%s'\n", optarg);
+                return false;
+            }
+            membudget.set_limit(limit);
+            break;
+        }
+
+        case 0x107: // Mini core
+            mini_core_path = optarg;
+            memory.record_frames();
+            break;
+
+        case 0x108: // O_DIRECT reads of the core file
+            memory.use_direct = true;
+            break;
+
+        case 0x109: // Cross-check direct map translations
+            host.verify_directmap = true;
+            break;
+
+        case 0x10a: // Reverse map a frame
+        {
+            char * end = NULL;
+            unsigned long long mfn = strtoull(optarg, &end, 0);
+
+            if ( end == optarg || *end )
+            {
+                printf("Invalid machine frame number '%s'\n", optarg);
+                return false;
+            }
+            rmap_mfns.push_back(mfn);
+            break;
+        }
+
         case 'h': // Help
         default: // Unrecognised
             usage(argv[0]);
@@ -417,6 +527,7 @@ static bool parse_commandline(int argc, char ** argv)
 int main(int argc, char ** argv)
 {
     char * path_buff = NULL;
+    std::vector<Abstract::Elf *> elfs;
     Abstract::Elf * elf = NULL;
 
     // Low memory environment - chances of getting std::bad_alloc are high
@@ -472,6 +583,10 @@ int main(int argc, char ** argv)
             return EX_SOFTWARE;
         }
 
+        // atexit() handlers run in reverse, so this runs before the log is closed
+        if ( atexit(atexit_memory_stats) )
+            LOG_WARN("call to atexit failed.  Memory statistics won't be logged\n");
+
         // Apply line buffering to the log file
         if ( setvbuf(logfd, NULL, _IOLBF, 1024) )
         {
@@ -553,37 +668,40 @@ int main(int argc, char ** argv)
             return EX_IOERR;
         }
 
-        // Log the crash file
-        if ( NULL == ( path_buff = realpath( core_path, NULL )))
+        if ( core_paths.empty() )
+            core_paths.push_back(default_core_path);
+
+        // Log the crash files
+        for ( size_t x = 0; x < core_paths.size(); ++x )
         {
-            LOG_ERROR("realpath failed for Core crash file path '%s': %s\n",
-                      core_path, strerror(errno));
+            if ( NULL == ( path_buff = realpath( core_paths[x], NULL )))
+            {
+                LOG_ERROR("realpath failed for Core crash file path '%s': %s\n",
+                          core_paths[x], strerror(errno));
+                free(path_buff);
+                return EX_SOFTWARE;
+            }
+            LOG_INFO("Elf CORE crash file: %s\n", path_buff);
             free(path_buff);
-            return EX_SOFTWARE;
         }
-        LOG_INFO("Elf CORE crash file: %s\n", path_buff);
-        free(path_buff);
 
-        // Evaluate what kind of elf file we have
-        if ( NULL == (elf = Abstract::Elf::create(core_path)) )
-        {
-            LOG_ERROR("Failed to parse the crash file\n");
-            return EX_IOERR;
-        }
+        // Work out how much memory we can use before anything large is allocated
+        membudget.setup();
 
-        // Parse the program headers and notes
-        if ( ! elf->parse() )
+        // Evaluate what kind of elf files we have, and parse the program headers and notes
+        if ( ! Abstract::Elf::create_set(core_paths, elfs) )
         {
             LOG_ERROR("Failed to parse the crash file\n");
-            SAFE_DELETE(elf);
             return EX_IOERR;
         }
+        elf = elfs[0];
 
         // Populate the memory regions
-        if ( ! memory.setup(core_path, elf) )
+        if ( ! memory.setup(core_paths, std::vector<const Abstract::Elf *>(
+                                elfs.begin(), elfs.end())) )
         {
             LOG_ERROR("Failed to set up memory regions from crash file\n");
-            SAFE_DELETE(elf);
+            Abstract::Elf::delete_set(elfs);
             return EX_SOFTWARE;
         }
 
@@ -591,12 +709,10 @@ int main(int argc, char ** argv)
         if ( ! host.setup(elf) )
         {
             LOG_ERROR("Failed to set up host structures\n");
-            SAFE_DELETE(elf);
+            Abstract::Elf::delete_set(elfs);
             return EX_SOFTWARE;
         }
 
-        SAFE_DELETE(elf);
-
         /* This ordering looks a little suspect, but it allows processing of the
          * subsequent work iff the previous work succeeds, along with fallthrough
          * error logic without gotos or returns. */
@@ -608,7 +724,16 @@ int main(int argc, char ** argv)
         {
             int s = host.print_domains(dump_structures);
             LOG_DEBUG("Successfully printed %d domains\n", s);
+
+            if ( ! rmap_mfns.empty() && ! host.print_reverse_map(rmap_mfns) )
+                LOG_ERROR("Failed to reverse map frames\n");
         }
+
+        if ( mini_core_path && ! memory.write_mini_core(mini_core_path, elf) )
+            LOG_ERROR("Failed to write mini core\n");
+
+        // Compressed crash files supply memory through the parsers.
+        Abstract::Elf::delete_set(elfs);
     }
     catch ( const std::bad_alloc & )
     {
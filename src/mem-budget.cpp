@@ -0,0 +1,136 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "mem-budget.hpp"
+#include "util/log.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+/**
+ * @file src/mem-budget.cpp
+ */
+
+/// Fraction of MemAvailable used as the default limit, as a shift.
+static const int DEFAULT_LIMIT_SHIFT = 1;
+
+MemBudget::MemBudget():
+    limit(0), explicit_limit(false), usage(0), peak(0), refused(0)
+{}
+
+void MemBudget::setup()
+{
+    char line[128];
+    unsigned long long kb;
+    FILE * f;
+
+    if ( this->explicit_limit )
+    {
+        LOG_INFO("Memory budget: %zu KiB\n", this->limit >> 10);
+        return;
+    }
+
+    if ( ! (f = fopen("/proc/meminfo", "r")) )
+    {
+        LOG_WARN("Unable to open /proc/meminfo.  Memory budget is unlimited\n");
+        return;
+    }
+
+    while ( fgets(line, sizeof line, f) )
+        if ( 1 == sscanf(line, "MemAvailable: %llu kB", &kb) )
+        {
+            this->limit = (size_t)((kb << 10) >> DEFAULT_LIMIT_SHIFT);
+            LOG_INFO("Memory budget: %zu KiB of %llu KiB available\n",
+                     this->limit >> 10, kb);
+            break;
+        }
+
+    if ( ! this->limit )
+        LOG_WARN("No MemAvailable in /proc/meminfo.  Memory budget is unlimited\n");
+
+    fclose(f);
+}
+
+void MemBudget::set_limit(size_t bytes)
+{
+    this->limit = bytes;
+    this->explicit_limit = true;
+}
+
+bool MemBudget::charge(size_t bytes)
+{
+    size_t old, now;
+
+    do
+    {
+        old = this->usage;
+        now = old + bytes;
+        if ( this->limit && now > this->limit )
+        {
+            __sync_fetch_and_add(&this->refused, 1);
+            return false;
+        }
+    } while ( ! __sync_bool_compare_and_swap(&this->usage, old, now) );
+
+    if ( now > this->peak )
+        this->peak = now;
+    return true;
+}
+
+void MemBudget::charge_required(size_t bytes)
+{
+    size_t now = __sync_add_and_fetch(&this->usage, bytes);
+
+    if ( now > this->peak )
+        this->peak = now;
+}
+
+void MemBudget::uncharge(size_t bytes)
+{
+    __sync_fetch_and_sub(&this->usage, bytes);
+}
+
+bool MemBudget::pressure() const
+{
+    return this->limit && this->usage > this->limit - (this->limit >> 2);
+}
+
+void MemBudget::log() const
+{
+    if ( ! this->limit )
+        return;
+
+    LOG_INFO("Memory budget: peak %zu KiB of %zu KiB, %"PRIu64" optional "
+             "allocations refused\n", this->peak >> 10, this->limit >> 10,
+             this->refused);
+}
+
+/// Memory budget
+MemBudget membudget;
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
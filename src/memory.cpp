@@ -20,6 +20,10 @@
 
 #include "memory.hpp"
 #include "util/log.hpp"
+#include "util/macros.hpp"
+#include "io-stats.hpp"
+#include "mem-budget.hpp"
+#include "Xen.h"
 
 #ifndef _LARGEFILE64_SOURCE
 #define _LARGEFILE64_SOURCE
@@ -27,11 +31,19 @@
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <map>
 
 /**
  * @file src/memory.cpp
@@ -41,57 +53,539 @@
 /// Buffer size for intermediate operations on larger blocks
 static const ssize_t BUFFER_SIZE = 8192;
 
+/// Default byte budget of the page cache.
+static const size_t DEFAULT_CACHE_BUDGET = 4 << 20;
+
+/// Smallest span which write_block_to_file() will transfer in the kernel.
+static const ssize_t MIN_ZERO_COPY = PAGE_SIZE;
+
+/// Approximate memory used per recorded frame: the value, plus tree links.
+static const size_t TOUCHED_FRAME_COST = sizeof(uint64_t) + 4 * sizeof(void *);
+
+/// Smallest read which pread_direct() streams rather than caching.
+static const ssize_t MIN_DIRECT_STREAM = 4 * PAGE_SIZE;
+
+/// Bounce buffer size for streamed O_DIRECT reads.
+static const ssize_t DIRECT_CHUNK = 64 * PAGE_SIZE;
+
+/// Position of the file index in O_DIRECT block cache keys.
+static const int DIRECT_FILE_SHIFT = 48;
+
+/// Largest gap between two reads which read_batch() will read through.
+static const uint64_t MAX_BATCH_GAP = PAGE_SIZE;
+
+#ifndef IOV_MAX
+/// Fallback for platforms which don't advertise IOV_MAX.
+#define IOV_MAX 1024
+#endif
+
+/// A run of coalesced reads, serviced with a single preadv().
+struct IORun
+{
+    /// File offset of the start of the run.
+    uint64_t start;
+    /// File offset of the end of the run.
+    uint64_t end;
+    /// Index of the first iovec of the run.
+    size_t first_iov;
+    /// Number of iovecs in the run.
+    size_t nr_iov;
+    /// Index of the first member read of the run.
+    size_t first_member;
+    /// Number of member reads in the run.
+    size_t nr_members;
+};
+
+/// Part of a batched read to be copied out of a freshly read frame.
+struct PendingCopy
+{
+    /// Index of the frame in the batch frame buffer.
+    size_t slot;
+    /// Offset into the frame.
+    size_t offset;
+    /// Destination buffer.
+    char * dst;
+    /// Length of the copy.
+    ssize_t n;
+};
+
 MemRegion::MemRegion():
-    start(0), length(0), offset(0)
+    start(0), length(0), offset(0), file(0), zero(false),
+    map(NULL), map_base(NULL), map_len(0)
 {}
 
 MemRegion::MemRegion(const ElfProgHdr & hdr):
-    start(hdr.phys), length(hdr.size), offset(hdr.offset)
+    start(hdr.phys), length(hdr.size), offset(hdr.offset), file(0), zero(false),
+    map(NULL), map_base(NULL), map_len(0)
 {}
 
 MemRegion::MemRegion(const MemRegion & rhs):
-    start(rhs.start), length(rhs.length), offset(rhs.offset)
+    start(rhs.start), length(rhs.length), offset(rhs.offset), file(rhs.file),
+    zero(rhs.zero), map(rhs.map), map_base(rhs.map_base), map_len(rhs.map_len)
 {}
 
+MemRegion & MemRegion::operator= (const MemRegion & rhs)
+{
+    this->start = rhs.start;
+    this->length = rhs.length;
+    this->offset = rhs.offset;
+    this->file = rhs.file;
+    this->zero = rhs.zero;
+    this->map = rhs.map;
+    this->map_base = rhs.map_base;
+    this->map_len = rhs.map_len;
+    return *this;
+}
+
 bool MemRegion::operator < (const MemRegion & rhs) const
 {
     return this->start < rhs.start;
 }
 
+/**
+ * Comparison for binary searching a sorted vector of memory regions.
+ * @param addr Machine address.
+ * @param region Memory region.
+ * @returns whether addr lies before the start of region.
+ */
+static bool before_region(const maddr_t & addr, const MemRegion & region)
+{
+    return addr < region.start;
+}
 
 
-Memory::Memory():
-    regions(), finalised(false), fd(-1)
+
+ReadBatch::ReadBatch():
+    entries()
 {}
 
+void ReadBatch::add(const uint64_t & addr, char * dst, ssize_t n)
+{
+    Entry e = { addr, dst, n };
+    this->entries.push_back(e);
+}
+
+void ReadBatch::add(const uint64_t & addr, uint8_t & dst)
+{
+    this->add(addr, (char*)&dst, 1);
+}
+
+void ReadBatch::add(const uint64_t & addr, uint16_t & dst)
+{
+    this->add(addr, (char*)&dst, 2);
+}
+
+void ReadBatch::add(const uint64_t & addr, uint32_t & dst)
+{
+    this->add(addr, (char*)&dst, 4);
+}
+
+void ReadBatch::add(const uint64_t & addr, uint64_t & dst)
+{
+    this->add(addr, (char*)&dst, 8);
+}
+
+
+
+Memory::Memory():
+    use_mmap(true), use_direct(false), regions(), last_region(0),
+    finalised(false), files(), compressed(false), direct(false),
+    cache(), can_copy_range(1), can_sendfile(1),
+    async_depth(0), async(NULL),
+    nr_zero_fill(0), recording(false), touched(), touched_lock()
+{
+    pthread_mutex_init(&this->touched_lock, NULL);
+    this->cache.set_budget(DEFAULT_CACHE_BUDGET);
+}
+
 Memory::~Memory()
 {
+    for ( std::vector<MemRegion>::iterator it = this->regions.begin();
+          it != this->regions.end(); ++it )
+        if ( it->map_base && -1 == munmap(it->map_base, it->map_len) )
+            LOG_ERROR("munmap() failed: %s\n", strerror(errno));
+
     this -> regions . clear ( ) ;
 
-    if ( this -> fd >= 0 )
+    SAFE_DELETE(this->async);
+    pthread_mutex_destroy(&this->touched_lock);
+
+    for ( std::vector<CoreFile>::iterator it = this->files.begin();
+          it != this->files.end(); ++it )
     {
-        if ( -1 == close( this -> fd ) )
+        if ( it->direct_fd >= 0 && -1 == close(it->direct_fd) )
+            LOG_ERROR("close() failed: %s\n", strerror(errno));
+        if ( it->fd >= 0 && -1 == close(it->fd) )
             LOG_ERROR("close() failed: %s\n", strerror(errno));
-        this -> fd = -1;
     }
+    this->files.clear();
 }
 
 bool Memory::setup(const char * path, const Abstract::Elf * elf)
 {
-    if ( (this->fd = open(path, O_RDONLY, NULL)) == -1)
+    return this->setup(std::vector<const char *>(1, path),
+                       std::vector<const Abstract::Elf *>(1, elf));
+}
+
+bool Memory::setup(const std::vector<const char *> & paths,
+                   const std::vector<const Abstract::Elf *> & elfs)
+{
+    struct stat64 st;
+    int nr_mapped = 0;
+    unsigned depth = this->async_depth;
+
+    for ( size_t f = 0; f < paths.size(); ++f )
     {
-        LOG_ERROR("open() failed: %s\n", strerror(errno));
-        return false;
+        CoreFile file = { -1, -1, elfs[f] };
+
+        if ( (file.fd = open(paths[f], O_RDONLY, NULL)) == -1)
+        {
+            LOG_ERROR("open() of %s failed: %s\n", paths[f], strerror(errno));
+            return false;
+        }
+        this->files.push_back(file);
+
+        for ( int x = 0; x < elfs[f]->nr_phdrs; ++x )
+        {
+            const ElfProgHdr & hdr = elfs[f]->phdrs[x];
+
+            if ( hdr.type != PT_LOAD )
+                continue;
+
+            if ( hdr.size )
+            {
+                this->regions.push_back(hdr);
+                this->regions.back().file = f;
+            }
+
+            // Anything past p_filesz is zero, and not in the file.
+            if ( hdr.memsz > hdr.size )
+            {
+                MemRegion tail(hdr);
+                tail.start = hdr.phys + hdr.size;
+                tail.length = hdr.memsz - hdr.size;
+                tail.file = f;
+                tail.zero = true;
+                this->regions.push_back(tail);
+            }
+        }
     }
 
-    this->regions.reserve(elf->nr_phdrs-1);
+    std::sort(this->regions.begin(), this->regions.end());
+
+    // Files of a set must partition the address space between them.
+    for ( size_t x = 1; x < this->regions.size(); ++x )
+        if ( this->regions[x-1].file != this->regions[x].file &&
+             this->regions[x-1].start + this->regions[x-1].length > this->regions[x].start )
+        {
+            LOG_ERROR("Memory region 0x%016"PRIx64" of %s overlaps a region of %s\n",
+                      this->regions[x].start, paths[this->regions[x].file],
+                      paths[this->regions[x-1].file]);
+            return false;
+        }
+
+    /* Compressed frames can't be mapped or read by offset.  Every read goes
+     * through the parser and the page cache. */
+    for ( size_t f = 0; f < elfs.size(); ++f )
+        if ( elfs[f]->compressed() != elfs[0]->compressed() )
+        {
+            LOG_ERROR("Can't mix compressed and uncompressed crash files\n");
+            return false;
+        }
+
+    if ( elfs[0]->compressed() )
+    {
+        this->compressed = true;
+        LOG_INFO("Reading compressed frames from the crash file\n");
+        return true;
+    }
+
+    /* O_DIRECT stops a saved core competing for the kdump kernel's page
+     * cache.  Every read then goes through pread_direct(), so mapping,
+     * in-kernel transfers and asynchronous reads are all off. */
+    if ( this->use_direct )
+    {
+        size_t f;
+
+        for ( f = 0; f < paths.size(); ++f )
+            if ( (this->files[f].direct_fd = open(paths[f], O_RDONLY | O_DIRECT, NULL)) == -1 )
+            {
+                LOG_INFO("O_DIRECT unavailable for %s: %s.  Using buffered reads\n",
+                         paths[f], strerror(errno));
+                break;
+            }
+
+        if ( f == paths.size() )
+        {
+            LOG_INFO("Reading the core file with O_DIRECT\n");
+            this->direct = true;
+            this->can_copy_range = this->can_sendfile = 0;
+            return true;
+        }
+
+        while ( f-- > 0 )
+        {
+            close(this->files[f].direct_fd);
+            this->files[f].direct_fd = -1;
+        }
+    }
+
+    // Read a split set with at least one reader per file.
+    if ( this->files.size() > 1 )
+        depth = std::max(depth, (unsigned)this->files.size());
+
+    if ( depth )
+    {
+        this->async = AsyncIO::create(depth);
+        if ( this->async )
+            LOG_INFO("Using %s asynchronous reads, depth %u\n",
+                     this->async->name(), depth);
+        else
+            LOG_WARN("Unable to set up asynchronous reads\n");
+    }
+
+    if ( ! this->use_mmap )
+        return true;
+
+    for ( size_t f = 0; f < this->files.size(); ++f )
+    {
+        uint64_t file_size = 0;
+
+        /* Mapping past the end of a regular file will SIGBUS on access, so
+         * make sure truncated cores still go via pread() and fail gracefully. */
+        if ( 0 == fstat64(this->files[f].fd, &st) )
+            file_size = st.st_size;
+        else
+            LOG_WARN("fstat() failed: %s\n", strerror(errno));
+
+        for ( std::vector<MemRegion>::iterator it = this->regions.begin();
+              it != this->regions.end(); ++it )
+            if ( it->file == f && this->map_region(*it, file_size) )
+                ++nr_mapped;
+    }
+
+    LOG_DEBUG("mmap()'d %d of %zu memory regions\n", nr_mapped, this->regions.size());
+
+    return true;
+}
+
+void Memory::set_cache_budget(size_t bytes)
+{
+    this->cache.set_budget(bytes);
+}
+
+void Memory::shrink()
+{
+    LOG_DEBUG("Dropping page cache to relieve memory pressure\n");
+    this->cache.flush();
+}
+
+void Memory::set_async_depth(unsigned depth)
+{
+    this->async_depth = depth;
+}
+
+void Memory::log_stats() const
+{
+    if ( this->nr_zero_fill )
+        LOG_INFO("Synthesised %"PRIu64" bytes of zeros for frames not in the crash file\n",
+                 this->nr_zero_fill);
+
+    if ( ! this->cache.enabled() )
+        return;
+
+    LOG_INFO("Page cache: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" evictions\n",
+             this->cache.nr_hits(), this->cache.nr_misses(),
+             this->cache.nr_evictions());
+}
+
+void Memory::record_frames()
+{
+    this->recording = true;
+}
+
+bool Memory::write_mini_core(const char * path, const Abstract::Elf * elf) const
+{
+    std::vector<Elf64_Phdr> phdrs;
+    std::set<uint64_t> frames;
+    const ElfProgHdr * note = NULL;
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr phdr;
+    FILE * file;
+    bool ok = true;
 
     for ( int x = 0; x < elf->nr_phdrs; ++x )
-        if ( elf->phdrs[x].type == PT_LOAD )
-            this->regions.push_back(elf->phdrs[x]);
+        if ( elf->phdrs[x].type == PT_NOTE )
+            note = &elf->phdrs[x];
 
-    std::sort(this->regions.begin(), this->regions.end());
+    if ( ! note || ! elf->notedata )
+    {
+        LOG_ERROR("No notes to write to the mini core\n");
+        return false;
+    }
+
+    pthread_mutex_lock(&this->touched_lock);
+    frames = this->touched;
+    pthread_mutex_unlock(&this->touched_lock);
+
+    std::memset(&phdr, 0, sizeof phdr);
+    phdr.p_type = PT_NOTE;
+    phdr.p_filesz = note->size;
+    phdrs.push_back(phdr);
+
+    /* Clip each frame to the regions it overlaps, merging contiguous
+     * spans.  Both the frames and the regions are sorted. */
+    std::vector<MemRegion>::const_iterator region = this->regions.begin();
+    for ( std::set<uint64_t>::const_iterator it = frames.begin();
+          it != frames.end(); ++it )
+    {
+        maddr_t base = *it << PAGE_SHIFT, end = base + PAGE_SIZE;
+
+        while ( region != this->regions.end() && region->start + region->length <= base )
+            ++region;
 
+        for ( std::vector<MemRegion>::const_iterator r = region;
+              r != this->regions.end() && r->start < end; ++r )
+        {
+            maddr_t start = std::max(base, r->start);
+            maddr_t stop = std::min(end, r->start + r->length);
+
+            if ( start >= stop )
+                continue;
+
+            // Zero spans can only extend a header's memsz-only tail.
+            Elf64_Phdr & last = phdrs.back();
+            if ( last.p_type == PT_LOAD && last.p_paddr + last.p_memsz == start &&
+                 ( r->zero || last.p_filesz == last.p_memsz ) )
+            {
+                if ( ! r->zero )
+                    last.p_filesz += stop - start;
+                last.p_memsz += stop - start;
+                continue;
+            }
+
+            phdr.p_type = PT_LOAD;
+            phdr.p_flags = PF_R | PF_W | PF_X;
+            phdr.p_paddr = start;
+            phdr.p_filesz = r->zero ? 0 : stop - start;
+            phdr.p_memsz = stop - start;
+            phdrs.push_back(phdr);
+        }
+    }
+
+    if ( phdrs.size() < 2 || phdrs.size() >= PN_XNUM )
+    {
+        LOG_ERROR("Unable to write a mini core of %zu program headers\n", phdrs.size());
+        return false;
+    }
+
+    // Notes follow the program headers.  Frames start page aligned.
+    uint64_t offset = sizeof ehdr + phdrs.size() * sizeof phdr;
+    phdrs[0].p_offset = offset;
+    offset += note->size;
+    for ( size_t x = 1; x < phdrs.size(); ++x )
+    {
+        offset = (offset + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
+        phdrs[x].p_offset = offset;
+        offset += phdrs[x].p_filesz;
+    }
+
+    std::memset(&ehdr, 0, sizeof ehdr);
+    std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = sizeof ehdr;
+    ehdr.e_ehsize = sizeof ehdr;
+    ehdr.e_phentsize = sizeof phdr;
+    ehdr.e_phnum = (Elf64_Half)phdrs.size();
+
+    if ( ! (file = fopen(path, "w")) )
+    {
+        LOG_ERROR("Unable to open mini core \"%s\": %s\n", path, strerror(errno));
+        return false;
+    }
+
+    try
+    {
+        if ( 1 != fwrite(&ehdr, sizeof ehdr, 1, file) ||
+             phdrs.size() != fwrite(&phdrs[0], sizeof phdr, phdrs.size(), file) ||
+             1 != fwrite(elf->notedata, note->size, 1, file) )
+            throw filewrite(errno);
+
+        for ( size_t x = 1; x < phdrs.size(); ++x )
+            if ( 0 != fseeko(file, (off_t)phdrs[x].p_offset, SEEK_SET) ||
+                 (ssize_t)phdrs[x].p_filesz != this->write_block_to_file(
+                     phdrs[x].p_paddr, file, (ssize_t)phdrs[x].p_filesz) )
+                throw filewrite(errno);
+    }
+    catch ( const filewrite & e )
+    {
+        e.log(path);
+        ok = false;
+    }
+    catch ( const CommonError & e )
+    {
+        e.log();
+        ok = false;
+    }
+
+    if ( 0 != fclose(file) && ok )
+    {
+        LOG_ERROR("Failed to close mini core \"%s\": %s\n", path, strerror(errno));
+        ok = false;
+    }
+
+    if ( ok )
+        LOG_INFO("Wrote mini core \"%s\": %zu frames in %zu regions, %"PRIu64" bytes\n",
+                 path, frames.size(), phdrs.size() - 1, offset);
+    return ok;
+}
+
+bool Memory::map_region(MemRegion & region, uint64_t file_size)
+{
+    static const uint64_t page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+    static bool warn_once = true;
+
+    uint64_t delta = region.offset & page_mask;
+    uint64_t len = region.length + delta;
+
+    if ( ! region.length || region.zero )
+        return false;
+
+    if ( region.offset + region.length > file_size )
+    {
+        LOG_DEBUG("Region 0x%016"PRIx64" extends beyond the end of the core file.  "
+                  "Not mapping\n", region.start);
+        return false;
+    }
+
+    // A 32bit kdump kernel can't map regions larger than its address space.
+    if ( len != (size_t)len )
+        return false;
+
+    void * base = mmap64(NULL, (size_t)len, PROT_READ, MAP_PRIVATE,
+                         this->files[region.file].fd,
+                         (off64_t)(region.offset - delta));
+
+    if ( base == MAP_FAILED )
+    {
+        if ( warn_once )
+        {
+            warn_once = false;
+            LOG_INFO("mmap() of the core file failed: %s.  Falling back to pread()\n",
+                     strerror(errno));
+        }
+        return false;
+    }
+
+    region.map_base = base;
+    region.map_len = (size_t)len;
+    region.map = (const char *)base + delta;
     return true;
 }
 
@@ -101,50 +595,36 @@ ssize_t Memory::read_str(const maddr_t & addr, char * dst, ssize_t n) const
         return 0;
     dst[0] = 0;
 
-    this->seek(addr);
-
-    ssize_t num_read = read(this->fd, dst, n-1);
+    this->read_block(addr, dst, n-1);
     dst[n] = 0;
-    if ( num_read == -1 || num_read != n-1)
-        throw memread(addr, num_read, n-1, errno);
     return strlen(dst);
 }
 
 ssize_t Memory::read_str_vaddr(const PageTable & pt, const vaddr_t & vaddr, char * dst, ssize_t n) const
 {
+    std::vector<PageTable::Extent> extents;
     maddr_t maddr;
     vaddr_t end;
+    ssize_t index = 0;
+
     pt.walk(vaddr, maddr, &end);
     if ( vaddr + n - 1 <= end )
         return this->read_str(maddr, dst, n);
-    else
+
+    pt.translate_range(vaddr, n, extents);
+    for ( std::vector<PageTable::Extent>::const_iterator it = extents.begin();
+          it != extents.end(); ++it )
     {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
-        {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subread (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            this->read_block(maddr, &dst[index], nr);
-            index += nr;
-            addr = end+1;
-            pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
-        dst[index] = 0;
-        return strlen(dst);
+        this->read_block(it->maddr, &dst[index], it->len);
+        index += it->len;
     }
+    dst[index] = 0;
+    return strlen(dst);
 }
 
 void Memory::read8(const maddr_t & addr, uint8_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 1);
-    if ( r == -1 || 1 != r )
-        throw memread(addr, r, 1, errno);
+    this->read_block(addr, (char*)&dst, 1);
 }
 
 void Memory::read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t & dst) const
@@ -157,10 +637,7 @@ void Memory::read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t &
 
 void Memory::read16(const maddr_t & addr, uint16_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 2);
-    if ( r == -1 || 2 != r )
-        throw memread(addr, r, 2, errno);
+    this->read_block(addr, (char*)&dst, 2);
 }
 
 void Memory::read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t & dst) const
@@ -170,10 +647,7 @@ void Memory::read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t
 
 void Memory::read32(const maddr_t & addr, uint32_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 4);
-    if ( r == -1 || 4 != r )
-        throw memread(addr, r, 4, errno);
+    this->read_block(addr, (char*)&dst, 4);
 }
 
 void Memory::read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t & dst) const
@@ -183,10 +657,7 @@ void Memory::read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t
 
 void Memory::read64(const maddr_t & addr, uint64_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 8);
-    if ( r == -1 || 8 != r )
-        throw memread(addr, r, 8, errno);
+    this->read_block(addr, (char*)&dst, 8);
 }
 
 void Memory::read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t & dst) const
@@ -196,133 +667,686 @@ void Memory::read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t
 
 void Memory::read_block(const maddr_t & addr, char * dst, ssize_t n) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, dst, n);
-    if ( r == -1 || r != n )
-        throw memread(addr, r, n, errno);
+    maddr_t cur = addr;
+
+    iostats.count_read(n);
+    this->touch(addr, n);
+
+    /* Split the read at region boundaries.  A read running off the end of one
+     * region must continue in a region starting at the very next byte. */
+    while ( n > 0 )
+    {
+        const MemRegion & region = this->find_region(cur);
+        uint64_t offset = cur - region.start;
+        ssize_t nr = (ssize_t)std::min((uint64_t)n, region.length - offset);
+
+        if ( region.zero )
+            this->zero_fill(dst, nr);
+        else if ( region.map )
+            std::memcpy(dst, region.map + offset, nr);
+        else if ( this->compressed )
+            this->read_compressed(region, cur, dst, nr);
+        else if ( this->direct )
+            this->pread_region(region, cur, dst, nr);
+        else if ( this->cache.enabled() )
+            this->read_region_cached(region, cur, dst, nr);
+        else
+            this->pread_region(region, cur, dst, nr);
+
+        cur += nr; dst += nr; n -= nr;
+    }
 }
 
 void Memory::read_block_vaddr(const PageTable & pt, const vaddr_t & vaddr, char * dst, ssize_t n) const
 {
+    std::vector<PageTable::Extent> extents;
     maddr_t maddr;
     vaddr_t end;
+
+    // Most reads are of a single field, which needs no extent list.
     pt.walk(vaddr, maddr, &end);
     if ( vaddr + n - 1 <= end )
+    {
         this->read_block(maddr, dst, n);
-    else
+        return;
+    }
+
+    pt.translate_range(vaddr, n, extents);
+    for ( std::vector<PageTable::Extent>::const_iterator it = extents.begin();
+          it != extents.end(); ++it )
+    {
+        this->read_block(it->maddr, dst, it->len);
+        dst += it->len;
+    }
+}
+
+void Memory::read_batch(const ReadBatch & batch) const
+{
+    std::vector<FileRead> reads;
+    std::vector<PendingCopy> copies;
+    std::map<uint64_t, size_t> frames;
+    char * frame_buf = NULL;
+
+    /* Compressed frames gain nothing from coalescing file reads, and the
+     * O_DIRECT reader has its own block cache. */
+    if ( this->compressed || this->direct )
     {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
+        for ( std::vector<ReadBatch::Entry>::const_iterator it = batch.entries.begin();
+              it != batch.entries.end(); ++it )
+            this->read_block(it->addr, it->dst, it->n);
+        return;
+    }
+
+    reads.reserve(batch.entries.size());
+
+    /* First pass: satisfy what we can from mappings and the page cache, and
+     * work out which file reads are needed for the rest.  Frames missing
+     * from the cache are read whole so they can be inserted afterwards. */
+    for ( std::vector<ReadBatch::Entry>::const_iterator it = batch.entries.begin();
+          it != batch.entries.end(); ++it )
+    {
+        maddr_t cur = it->addr;
+        char * dst = it->dst;
+        ssize_t n = it->n;
+
+        iostats.count_read(n);
+        this->touch(cur, n);
+
+        while ( n > 0 )
         {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subread (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            this->read_block(maddr, &dst[index], nr);
-            index += nr;
-            addr = end+1;
-            pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
+            const MemRegion & region = this->find_region(cur);
+            uint64_t offset = cur - region.start;
+            ssize_t nr = (ssize_t)std::min((uint64_t)n, region.length - offset);
+            maddr_t base = cur & ~(PAGE_SIZE-1);
+
+            if ( region.zero )
+                this->zero_fill(dst, nr);
+            else if ( region.map )
+                std::memcpy(dst, region.map + offset, nr);
+            else if ( ! this->cache.enabled() || base < region.start ||
+                      base + PAGE_SIZE - region.start > region.length )
+            {
+                FileRead r = { region.file, region.offset + offset, cur, dst, nr };
+                reads.push_back(r);
+            }
+            else
+            {
+                size_t foff = cur & (PAGE_SIZE-1);
+                nr = (ssize_t)std::min((uint64_t)nr, (uint64_t)(PAGE_SIZE - foff));
+
+                if ( ! this->cache.lookup(base >> PAGE_SHIFT, foff, dst, nr) )
+                {
+                    std::map<uint64_t, size_t>::iterator f = frames.find(base);
+
+                    if ( f == frames.end() )
+                    {
+                        f = frames.insert(std::make_pair(base, frames.size())).first;
+                        FileRead r = { region.file, region.offset + (base - region.start),
+                                       base, NULL, (ssize_t)PAGE_SIZE };
+                        reads.push_back(r);
+                    }
+
+                    PendingCopy c = { f->second, foff, dst, nr };
+                    copies.push_back(c);
+                }
+            }
+
+            cur += nr; dst += nr; n -= nr;
+        }
+    }
+
+    if ( frames.size() )
+    {
+        frame_buf = new char[frames.size() * PAGE_SIZE];
+        membudget.charge_required(frames.size() * PAGE_SIZE);
+
+        for ( std::vector<FileRead>::iterator it = reads.begin();
+              it != reads.end(); ++it )
+            if ( ! it->dst )
+                it->dst = frame_buf + frames[it->addr] * PAGE_SIZE;
     }
+
+    try
+    {
+        this->preadv_coalesced(reads);
+
+        // Second pass: populate the cache and satisfy reads from the new frames.
+        for ( std::map<uint64_t, size_t>::const_iterator it = frames.begin();
+              it != frames.end(); ++it )
+            this->cache.insert(it->first >> PAGE_SHIFT,
+                               frame_buf + it->second * PAGE_SIZE);
+
+        for ( std::vector<PendingCopy>::const_iterator it = copies.begin();
+              it != copies.end(); ++it )
+            std::memcpy(it->dst, frame_buf + it->slot * PAGE_SIZE + it->offset, it->n);
+    }
+    catch ( ... )
+    {
+        membudget.uncharge(frames.size() * PAGE_SIZE);
+        SAFE_DELETE_ARRAY(frame_buf);
+        throw;
+    }
+
+    membudget.uncharge(frames.size() * PAGE_SIZE);
+    SAFE_DELETE_ARRAY(frame_buf);
+}
+
+void Memory::read_batch_vaddr(const PageTable & pt, const ReadBatch & batch) const
+{
+    std::vector<PageTable::Extent> extents;
+    ReadBatch mbatch;
+
+    mbatch.entries.reserve(batch.entries.size());
+
+    for ( std::vector<ReadBatch::Entry>::const_iterator it = batch.entries.begin();
+          it != batch.entries.end(); ++it )
+    {
+        char * dst = it->dst;
+
+        pt.translate_range(it->addr, it->n, extents);
+        for ( std::vector<PageTable::Extent>::const_iterator e = extents.begin();
+              e != extents.end(); ++e )
+        {
+            mbatch.add(e->maddr, dst, e->len);
+            dst += e->len;
+        }
+    }
+
+    this->read_batch(mbatch);
+}
+
+/**
+ * Atomically test a flag which other threads may clear.
+ * @param flag Flag.
+ * @returns boolean value of the flag.
+ */
+static inline bool test_flag(int & flag)
+{
+    return __sync_fetch_and_or(&flag, 0) != 0;
+}
+
+/**
+ * Atomically clear a flag.
+ * @param flag Flag.
+ */
+static inline void clear_flag(int & flag)
+{
+    __sync_fetch_and_and(&flag, 0);
 }
 
 ssize_t Memory::write_block_to_file(const maddr_t & addr, FILE * file, ssize_t n) const
 {
     ssize_t num_read, num_wrote, total_written = 0;
+    maddr_t cur = addr;
+    char tmp[BUFFER_SIZE];
+    int out_fd = -1;
+    bool transferred = false;
 
-    if ( ! n )
-        return 0;
+    iostats.count_read(n);
+    this->touch(addr, n);
 
-    this->seek(addr);
+    // Only regular files are eligible for in-kernel transfers.
+    if ( n >= MIN_ZERO_COPY && ! this->compressed &&
+         ( test_flag(this->can_copy_range) || test_flag(this->can_sendfile) ) )
+    {
+        struct stat64 st;
+        int f = fileno(file);
 
-    char * tmp = new char[BUFFER_SIZE];
+        if ( f >= 0 && 0 == fstat64(f, &st) && S_ISREG(st.st_mode) )
+            out_fd = f;
+    }
 
-    while ( n > BUFFER_SIZE )
+    while ( n > 0 )
     {
-        num_read = read(this->fd, tmp, BUFFER_SIZE);
-        if ( num_read == -1 || num_read != BUFFER_SIZE )
+        const MemRegion & region = this->find_region(cur);
+        uint64_t offset = cur - region.start;
+        ssize_t nr = (ssize_t)std::min((uint64_t)n, region.length - offset);
+
+        // Zero regions have nothing to read.
+        if ( region.zero )
         {
-            delete [] tmp;
-            throw memread(addr, num_read, BUFFER_SIZE, errno);
+            std::memset(tmp, 0, sizeof tmp);
+            while ( nr > 0 )
+            {
+                num_read = std::min(nr, BUFFER_SIZE);
+                this->zero_fill(NULL, num_read);
+
+                num_wrote = fwrite(tmp, 1, num_read, file);
+                n -= num_wrote; nr -= num_wrote;
+                total_written += num_wrote; cur += num_wrote;
+
+                if ( num_wrote != num_read )
+                {
+                    n = 0;
+                    break;
+                }
+            }
+            continue;
         }
 
-        num_wrote = fwrite(tmp, 1, num_read, file);
-        n -= num_wrote; total_written += num_wrote;
+        // Mapped regions can be written straight out of the mapping.
+        if ( region.map )
+        {
+            num_wrote = fwrite(region.map + offset, 1, nr, file);
+            n -= num_wrote; total_written += num_wrote; cur += num_wrote;
+
+            if ( num_wrote != nr )
+                break;
+            continue;
+        }
 
-        if ( num_read != BUFFER_SIZE || num_wrote != num_read )
+        /* Bypass the stream for large spans.  Anything already buffered must
+         * be written first, and anything not transferred (e.g. neither method
+         * is supported by the CORE file) falls through to the buffered path. */
+        if ( out_fd >= 0 && nr >= MIN_ZERO_COPY && 0 == fflush(file) )
         {
-            delete [] tmp;
-            return total_written;
+            num_wrote = this->transfer_region(region, cur, out_fd, nr);
+            if ( num_wrote > 0 )
+                transferred = true;
+            n -= num_wrote; nr -= num_wrote;
+            total_written += num_wrote; cur += num_wrote;
         }
-    }
 
-    num_read = read(this->fd, tmp, n);
-    if ( num_read == -1 || num_read != n )
-    {
-        delete [] tmp;
-        throw memread(addr, num_read, n, errno);
+        while ( nr > 0 )
+        {
+            num_read = std::min(nr, BUFFER_SIZE);
+
+            if ( this->compressed )
+                this->read_compressed(region, cur, tmp, num_read);
+            else
+                this->pread_region(region, cur, tmp, num_read);
+
+            num_wrote = fwrite(tmp, 1, num_read, file);
+            n -= num_wrote; nr -= num_wrote;
+            total_written += num_wrote; cur += num_wrote;
+
+            if ( num_wrote != num_read )
+            {
+                n = 0;
+                break;
+            }
+        }
     }
 
-    num_wrote = fwrite(tmp, 1, num_read, file);
-    n -= num_wrote; total_written += num_wrote;
+    // Resynchronise the stream with the descriptor's file position.
+    if ( transferred && ( 0 != fflush(file) || 0 != fseeko(file, 0, SEEK_CUR) ) )
+        LOG_WARN("Failed to resynchronise output stream: %s\n", strerror(errno));
 
-    delete [] tmp;
     return total_written;
 }
 
 ssize_t Memory::write_block_vaddr_to_file(const PageTable & pt, const vaddr_t & vaddr, FILE * file, ssize_t n) const
 {
-    maddr_t maddr;
-    vaddr_t end;
-    pt.walk(vaddr, maddr, &end);
-    if ( vaddr + n - 1 <= end )
-        return this->write_block_to_file(maddr, file, n);
-    else
+    std::vector<PageTable::Extent> extents;
+    ssize_t total = 0;
+
+    pt.translate_range(vaddr, n, extents);
+    for ( std::vector<PageTable::Extent>::const_iterator it = extents.begin();
+          it != extents.end(); ++it )
     {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
+        ssize_t w = this->write_block_to_file(it->maddr, file, it->len);
+
+        total += w;
+        if ( w != (ssize_t)it->len )
+            break;
+    }
+    return total;
+}
+
+const MemRegion & Memory::find_region(const maddr_t & addr) const
+{
+    size_t hint = this->last_region;
+
+    iostats.count_lookup();
+
+    if ( hint < this->regions.size() &&
+         this->regions[hint].start <= addr &&
+         addr - this->regions[hint].start < this->regions[hint].length )
+        return this->regions[hint];
+
+    std::vector<MemRegion>::const_iterator it = std::upper_bound(
+        this->regions.begin(), this->regions.end(), addr, before_region);
+
+    if ( it != this->regions.begin() )
+    {
+        --it;
+        if ( addr - it->start < it->length )
         {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subwrite (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            ssize_t w = this->write_block_to_file(maddr, file, nr);
-            index += w;
-            if ( w != nr )
-                return index + w;
-            addr = end+1;
-            pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
-        return index;
+            this->last_region = it - this->regions.begin();
+            return *it;
+        }
     }
+
+    LOG_WARN("Memory region for 0x%016"PRIx64" not found\n", addr);
+    throw memseek(addr, 0);
 }
 
-void Memory::seek(const maddr_t & addr) const
+ssize_t Memory::transfer_region(const MemRegion & region, const maddr_t & addr,
+                                int out_fd, ssize_t n) const
 {
-    for ( std::vector<MemRegion>::const_iterator it = this->regions.begin();
-          it != this->regions.end(); ++it)
+    loff_t foffset = addr - region.start + region.offset;
+    ssize_t total = 0, r;
+
+    while ( total < n )
     {
-        if ( it->start <= addr && addr < (it->start + it->length) )
+        if ( test_flag(this->can_copy_range) )
+        {
+#ifdef __NR_copy_file_range
+            r = syscall(__NR_copy_file_range, this->files[region.file].fd,
+                        &foffset, out_fd,
+                        NULL, (size_t)(n - total), 0U);
+#else
+            r = -1; errno = ENOSYS;
+#endif
+            // Typically cross-filesystem copies on older kernels.
+            if ( r == -1 && ( errno == ENOSYS || errno == EXDEV ||
+                              errno == EINVAL || errno == EOPNOTSUPP ||
+                              errno == EBADF ) )
+            {
+                clear_flag(this->can_copy_range);
+                continue;
+            }
+        }
+        else if ( test_flag(this->can_sendfile) )
         {
-            int64_t foffset = addr - it->start + it->offset;
-            if ( (-(off64_t)1) == lseek64(this->fd, foffset, SEEK_SET) )
+            off64_t off = foffset;
+
+            r = sendfile64(out_fd, this->files[region.file].fd, &off,
+                           (size_t)(n - total));
+            // Typically /proc/vmcore, which doesn't support splicing.
+            if ( r == -1 && ( errno == ENOSYS || errno == EINVAL ) )
             {
-                LOG_WARN("Failure to seek: maddr 0x%016"PRIx64", foffset 0x"PRIx64": %s\n",
-                         addr, foffset, strerror(errno));
-                throw memseek(addr, foffset);
+                clear_flag(this->can_sendfile);
+                break;
             }
-            return;
+            foffset = off;
         }
+        else
+            break;
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            break;
+        total += r;
     }
 
-    LOG_WARN("Memory region for 0x%016"PRIx64" not found\n", addr);
-    throw memseek(addr, 0);
+    return total;
+}
+
+void Memory::pread_region(const MemRegion & region, const maddr_t & addr,
+                          char * dst, ssize_t n) const
+{
+    this->pread_file(region.file, addr - region.start + region.offset, addr, dst, n);
+}
+
+void Memory::pread_file(size_t file, uint64_t foffset, const maddr_t & addr,
+                        char * dst, ssize_t n) const
+{
+    ssize_t total = 0, r;
+
+    if ( this->direct )
+    {
+        this->pread_direct(file, foffset, addr, dst, n);
+        return;
+    }
+
+    // Short reads are only expected at the end of a truncated core.
+    while ( total < n )
+    {
+        r = pread64(this->files[file].fd, dst + total, n - total, foffset + total);
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+        if ( r == -1 )
+            throw memread(addr, r, n, errno);
+        if ( r == 0 )
+            throw memread(addr, total, n, 0);
+        total += r;
+    }
+}
+
+void Memory::pread_direct(size_t file, uint64_t foffset, const maddr_t & addr,
+                          char * dst, ssize_t n) const
+{
+    char block[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+    char * bounce = block;
+    ssize_t len = PAGE_SIZE, r;
+    bool stream = false;
+
+    // Large reads aren't worth caching.  Stream them if we can.
+    if ( n >= MIN_DIRECT_STREAM && membudget.charge(DIRECT_CHUNK) )
+    {
+        if ( 0 == posix_memalign((void **)&bounce, PAGE_SIZE, DIRECT_CHUNK) )
+        {
+            len = DIRECT_CHUNK;
+            stream = true;
+        }
+        else
+        {
+            bounce = block;
+            membudget.uncharge(DIRECT_CHUNK);
+        }
+    }
+
+    try
+    {
+        while ( n > 0 )
+        {
+            uint64_t base = foffset & ~(PAGE_SIZE-1);
+            uint64_t key = (base >> PAGE_SHIFT) | ((uint64_t)file << DIRECT_FILE_SHIFT);
+            size_t offset = foffset - base;
+            ssize_t nr = (ssize_t)std::min((uint64_t)n, (uint64_t)(len - offset));
+
+            if ( ! stream && this->cache.lookup(key, offset, dst, nr) )
+            {
+                foffset += nr; dst += nr; n -= nr;
+                continue;
+            }
+
+            // Only the tail of the core may be short.
+            do
+                r = pread64(this->files[file].direct_fd, bounce, len, base);
+            while ( r == -1 && errno == EINTR );
+
+            if ( r == -1 )
+                throw memread(addr, r, n, errno);
+            if ( r < (ssize_t)offset + nr )
+                throw memread(addr, std::max(r - (ssize_t)offset, (ssize_t)0), nr, 0);
+
+            if ( ! stream && r == len )
+                this->cache.insert(key, bounce);
+
+            std::memcpy(dst, bounce + offset, nr);
+            foffset += nr; dst += nr; n -= nr;
+        }
+    }
+    catch ( const memread & )
+    {
+        if ( stream )
+        {
+            free(bounce);
+            membudget.uncharge(DIRECT_CHUNK);
+        }
+        throw;
+    }
+
+    if ( stream )
+    {
+        free(bounce);
+        membudget.uncharge(DIRECT_CHUNK);
+    }
+}
+
+void Memory::preadv_coalesced(std::vector<FileRead> & reads) const
+{
+    static const size_t iov_max = IOV_MAX;
+    char gap[MAX_BATCH_GAP];
+    std::vector<struct iovec> iov;
+    std::vector<size_t> members;
+    std::vector<size_t> overlaps;
+    std::vector<IORun> runs;
+    size_t i = 0, j;
+
+    std::sort(reads.begin(), reads.end());
+    iov.reserve(reads.size() * 2);
+
+    while ( i < reads.size() )
+    {
+        IORun run = { reads[i].foffset, reads[i].foffset + reads[i].n,
+                      iov.size(), 0, members.size(), 0 };
+        struct iovec v;
+
+        v.iov_base = reads[i].dst; v.iov_len = reads[i].n;
+        iov.push_back(v);
+        members.push_back(i);
+
+        // Extend the run with each following read close enough to join it.
+        for ( j = i + 1; j < reads.size() &&
+                  iov.size() - run.first_iov + 2 <= iov_max; ++j )
+        {
+            const FileRead & r = reads[j];
+
+            if ( r.file != reads[i].file )
+                break;
+
+            if ( r.foffset < run.end )
+            {
+                overlaps.push_back(j);
+                continue;
+            }
+
+            if ( r.foffset - run.end > MAX_BATCH_GAP )
+                break;
+
+            if ( r.foffset > run.end )
+            {
+                v.iov_base = gap; v.iov_len = r.foffset - run.end;
+                iov.push_back(v);
+            }
+
+            v.iov_base = r.dst; v.iov_len = r.n;
+            iov.push_back(v);
+            members.push_back(j);
+            run.end = r.foffset + r.n;
+        }
+
+        run.nr_iov = iov.size() - run.first_iov;
+        run.nr_members = members.size() - run.first_member;
+        runs.push_back(run);
+        i = j;
+    }
+
+    std::vector<AsyncIO::Request> reqs(runs.size());
+    for ( size_t k = 0; k < runs.size(); ++k )
+    {
+        reqs[k].fd = this->files[reads[members[runs[k].first_member]].file].fd;
+        reqs[k].offset = runs[k].start;
+        reqs[k].iov = &iov[runs[k].first_iov];
+        reqs[k].iovcnt = (int)runs[k].nr_iov;
+        reqs[k].result = 0;
+    }
+
+    // Independent runs can all be in flight at once.
+    if ( this->async && reqs.size() > 1 )
+        this->async->read_all(reqs);
+    else
+        for ( size_t k = 0; k < reqs.size(); ++k )
+            do
+                reqs[k].result = preadv64(reqs[k].fd, reqs[k].iov, reqs[k].iovcnt,
+                                          reqs[k].offset);
+            while ( reqs[k].result == -1 && errno == EINTR );
+
+    // Short reads are unexpected; redo the run piecewise to find the culprit.
+    for ( size_t k = 0; k < runs.size(); ++k )
+        if ( reqs[k].result != (ssize_t)(runs[k].end - runs[k].start) )
+            for ( size_t m = runs[k].first_member;
+                  m < runs[k].first_member + runs[k].nr_members; ++m )
+                this->pread_file(reads[members[m]].file, reads[members[m]].foffset,
+                                 reads[members[m]].addr, reads[members[m]].dst,
+                                 reads[members[m]].n);
+
+    for ( std::vector<size_t>::const_iterator it = overlaps.begin();
+          it != overlaps.end(); ++it )
+        this->pread_file(reads[*it].file, reads[*it].foffset, reads[*it].addr,
+                         reads[*it].dst, reads[*it].n);
+}
+
+void Memory::read_region_cached(const MemRegion & region, const maddr_t & addr,
+                                char * dst, ssize_t n) const
+{
+    char page[PAGE_SIZE];
+    maddr_t cur = addr;
+
+    while ( n > 0 )
+    {
+        maddr_t base = cur & ~(PAGE_SIZE-1);
+        size_t offset = cur & (PAGE_SIZE-1);
+        ssize_t nr = (ssize_t)std::min((uint64_t)n, (uint64_t)(PAGE_SIZE - offset));
+
+        if ( base < region.start || base + PAGE_SIZE - region.start > region.length )
+            this->pread_region(region, cur, dst, nr);
+        else if ( ! this->cache.lookup(base >> PAGE_SHIFT, offset, dst, nr) )
+        {
+            this->pread_region(region, base, page, PAGE_SIZE);
+            this->cache.insert(base >> PAGE_SHIFT, page);
+            std::memcpy(dst, page + offset, nr);
+        }
+
+        cur += nr; dst += nr; n -= nr;
+    }
+}
+
+/// Bytes read from zero regions by this thread.
+static __thread uint64_t thread_zero_fills = 0;
+
+uint64_t Memory::zero_fills()
+{
+    return thread_zero_fills;
+}
+
+void Memory::zero_fill(char * dst, ssize_t n) const
+{
+    if ( dst )
+        std::memset(dst, 0, n);
+
+    thread_zero_fills += n;
+    __sync_fetch_and_add(&this->nr_zero_fill, (uint64_t)n);
+}
+
+void Memory::touch(const maddr_t & addr, ssize_t n) const
+{
+    if ( ! this->recording || n <= 0 )
+        return;
+
+    pthread_mutex_lock(&this->touched_lock);
+    for ( uint64_t pfn = addr >> PAGE_SHIFT; pfn <= (addr + n - 1) >> PAGE_SHIFT; ++pfn )
+        if ( this->touched.insert(pfn).second )
+            membudget.charge_required(TOUCHED_FRAME_COST);
+    pthread_mutex_unlock(&this->touched_lock);
+}
+
+void Memory::read_compressed(const MemRegion & region, const maddr_t & addr,
+                             char * dst, ssize_t n) const
+{
+    char page[PAGE_SIZE];
+    maddr_t cur = addr;
+
+    while ( n > 0 )
+    {
+        uint64_t pfn = cur >> PAGE_SHIFT;
+        size_t offset = cur & (PAGE_SIZE-1);
+        ssize_t nr = (ssize_t)std::min((uint64_t)n, (uint64_t)(PAGE_SIZE - offset));
+
+        if ( ! this->cache.lookup(pfn, offset, dst, nr) )
+        {
+            this->files[region.file].elf->read_page(pfn, page);
+            this->cache.insert(pfn, page);
+            std::memcpy(dst, page + offset, nr);
+        }
+
+        cur += nr; dst += nr; n -= nr;
+    }
 }
 
 /// Memory
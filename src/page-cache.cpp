@@ -0,0 +1,179 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "page-cache.hpp"
+#include "Xen.h"
+#include "mem-budget.hpp"
+
+#include <cstring>
+#include <new>
+
+/**
+ * @file src/page-cache.cpp
+ */
+
+PageCache::PageCache():
+    slots(), index(), max_slots(0), hand(0), hits(0), misses(0), evictions(0),
+    lock()
+{
+    pthread_mutex_init(&this->lock, NULL);
+}
+
+PageCache::~PageCache()
+{
+    this->free_slots();
+    pthread_mutex_destroy(&this->lock);
+}
+
+void PageCache::set_budget(size_t bytes)
+{
+    pthread_mutex_lock(&this->lock);
+    this->free_slots();
+    this->max_slots = bytes / PAGE_SIZE;
+    pthread_mutex_unlock(&this->lock);
+}
+
+bool PageCache::lookup(uint64_t frame, size_t offset, char * dst, size_t n)
+{
+    std::map<uint64_t, size_t>::const_iterator it;
+    bool hit = false;
+
+    pthread_mutex_lock(&this->lock);
+
+    it = this->index.find(frame);
+    if ( it != this->index.end() )
+    {
+        Slot & slot = this->slots[it->second];
+
+        std::memcpy(dst, slot.data + offset, n);
+        slot.referenced = true;
+        ++this->hits;
+        hit = true;
+    }
+    else
+        ++this->misses;
+
+    pthread_mutex_unlock(&this->lock);
+    return hit;
+}
+
+void PageCache::insert(uint64_t frame, const char * data)
+{
+    size_t victim;
+
+    if ( ! this->max_slots )
+        return;
+
+    pthread_mutex_lock(&this->lock);
+
+    // Another thread may have raced us to fill this frame.
+    if ( this->index.count(frame) )
+    {
+        pthread_mutex_unlock(&this->lock);
+        return;
+    }
+
+    /* Only grow while the memory budget allows, otherwise recycle slots.
+     * With no slots at all, the frame simply isn't cached. */
+    if ( this->slots.size() < this->max_slots && ! membudget.pressure() &&
+         membudget.charge(PAGE_SIZE) )
+    {
+        Slot slot = { frame, NULL, false };
+
+        try
+        {
+            slot.data = new char[PAGE_SIZE];
+            this->slots.push_back(slot);
+        }
+        catch ( const std::bad_alloc & )
+        {
+            // Caching is optional; don't fail the read for it.
+            delete [] slot.data;
+            membudget.uncharge(PAGE_SIZE);
+            pthread_mutex_unlock(&this->lock);
+            return;
+        }
+
+        victim = this->slots.size() - 1;
+    }
+    else if ( this->slots.empty() )
+    {
+        pthread_mutex_unlock(&this->lock);
+        return;
+    }
+    else
+    {
+        // Sweep the hand, giving referenced frames a second chance.
+        while ( this->slots[this->hand].referenced )
+        {
+            this->slots[this->hand].referenced = false;
+            this->hand = (this->hand + 1) % this->slots.size();
+        }
+
+        victim = this->hand;
+        this->hand = (this->hand + 1) % this->slots.size();
+        this->index.erase(this->slots[victim].frame);
+        this->slots[victim].frame = frame;
+        this->slots[victim].referenced = false;
+        ++this->evictions;
+    }
+
+    std::memcpy(this->slots[victim].data, data, PAGE_SIZE);
+
+    /* If the index can't grow, the slot is left unindexed, to be recycled
+     * by the hand in due course. */
+    try
+    {
+        this->index[frame] = victim;
+    }
+    catch ( const std::bad_alloc & )
+    {}
+
+    pthread_mutex_unlock(&this->lock);
+}
+
+void PageCache::flush()
+{
+    pthread_mutex_lock(&this->lock);
+    this->free_slots();
+    pthread_mutex_unlock(&this->lock);
+}
+
+void PageCache::free_slots()
+{
+    for ( std::vector<Slot>::iterator it = this->slots.begin();
+          it != this->slots.end(); ++it )
+        delete [] it->data;
+
+    membudget.uncharge(this->slots.size() * PAGE_SIZE);
+    this->slots.clear();
+    this->index.clear();
+    this->hand = 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,91 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "pte-cache.hpp"
+#include "mem-budget.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+
+/**
+ * @file src/pte-cache.cpp
+ */
+
+PTECache::PTECache():
+    entries(NULL), refused(false), hits(0), misses(0)
+{}
+
+PTECache::~PTECache()
+{
+    if ( this->entries )
+        membudget.uncharge(PTECACHE_SLOTS * sizeof (Slot));
+    SAFE_DELETE_ARRAY(this->entries);
+}
+
+void PTECache::insert(const maddr_t & addr, const uint64_t & entry)
+{
+    if ( ! this->entries )
+    {
+        if ( this->refused ||
+             ! membudget.charge(PTECACHE_SLOTS * sizeof (Slot)) )
+        {
+            this->refused = true;
+            return;
+        }
+
+        this->entries = new Slot[PTECACHE_SLOTS];
+        this->flush();
+    }
+
+    Slot & s = this->entries[PTECache::index(addr)];
+
+    s.addr = addr;
+    s.entry = entry;
+}
+
+void PTECache::flush()
+{
+    if ( ! this->entries )
+        return;
+
+    for ( size_t x = 0; x < PTECACHE_SLOTS; ++x )
+        this->entries[x].addr = ~0ULL;
+}
+
+void PTECache::log() const
+{
+    if ( ! this->hits && ! this->misses )
+        return;
+
+    LOG_INFO("Paging-structure cache: %"PRIu64" hits, %"PRIu64" misses\n",
+             this->hits, this->misses);
+}
+
+/// Paging-structure cache
+PTECache ptecache;
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
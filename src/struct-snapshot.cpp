@@ -0,0 +1,85 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2016 Citrix Inc.
+ */
+
+#include "struct-snapshot.hpp"
+#include "memory.hpp"
+#include "exceptions.hpp"
+
+#include <cstring>
+
+/**
+ * @file src/struct-snapshot.cpp
+ */
+
+/// Largest structure which will be snapshotted.  Guards against bad xensyms.
+static const vaddr_t MAX_SNAPSHOT_SIZE = 64 << 10;
+
+StructSnapshot::StructSnapshot():
+    addr(0), data()
+{}
+
+void StructSnapshot::read(const Abstract::PageTable & pt, const vaddr_t & addr,
+                          const vaddr_t & size)
+{
+    if ( ! size || size > MAX_SNAPSHOT_SIZE )
+        throw validate(addr, "Implausible structure size");
+
+    this->addr = addr;
+    this->data.resize(size);
+    memory.read_block_vaddr(pt, addr, &this->data[0], size);
+}
+
+void StructSnapshot::get(const vaddr_t & offset, char * dst, size_t n) const
+{
+    if ( offset > this->data.size() || n > this->data.size() - offset )
+        throw validate(this->addr + offset, "Field outside of structure snapshot");
+
+    std::memcpy(dst, &this->data[offset], n);
+}
+
+void StructSnapshot::get(const vaddr_t & offset, uint8_t & dst) const
+{
+    this->get(offset, (char*)&dst, 1);
+}
+
+void StructSnapshot::get(const vaddr_t & offset, uint16_t & dst) const
+{
+    this->get(offset, (char*)&dst, 2);
+}
+
+void StructSnapshot::get(const vaddr_t & offset, uint32_t & dst) const
+{
+    this->get(offset, (char*)&dst, 4);
+}
+
+void StructSnapshot::get(const vaddr_t & offset, uint64_t & dst) const
+{
+    this->get(offset, (char*)&dst, 8);
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,6 +20,9 @@
 
 #include "util/misc.hpp"
 
+#include <cstdlib>
+#include <cerrno>
+
 /**
  * @file src/util/misc.cpp
  * @author Andrew Cooper
@@ -33,6 +36,39 @@ bool is_zeroes(const char * buffer, const size_t size)
     return i == size;
 }
 
+bool parse_size(const char * str, size_t & size)
+{
+    char * end = NULL;
+    unsigned long long val;
+    unsigned shift = 0;
+
+    errno = 0;
+    val = strtoull(str, &end, 0);
+    if ( errno || end == str )
+        return false;
+
+    switch ( *end )
+    {
+    case 'G': case 'g':
+        shift += 10;
+        /* Fallthrough */
+    case 'M': case 'm':
+        shift += 10;
+        /* Fallthrough */
+    case 'K': case 'k':
+        shift += 10;
+        ++end;
+        break;
+    }
+
+    if ( *end || ( val << shift ) >> shift != val ||
+         (size_t)( val << shift ) != ( val << shift ) )
+        return false;
+
+    size = (size_t)( val << shift );
+    return true;
+}
+
 
 /*
  * Local variables:
@@ -30,12 +30,35 @@
 #include "util/macros.hpp"
 #include "util/stdio-wrapper.hpp"
 #include "memory.hpp"
+#include "io-stats.hpp"
 
 #include <limits.h>
 
+/**
+ * Note in the output how much of a dump was synthesised as zero, rather
+ * than read from the crash file.
+ * @param o Output file.
+ * @param before Memory::zero_fills() from before the dump.
+ * @param what Description of the dump.
+ * @returns number of bytes written.
+ */
+static int note_zero_fills(FILE * o, uint64_t before, const char * what)
+{
+    uint64_t n = Memory::zero_fills() - before;
+
+    if ( ! n )
+        return 0;
+
+    LOG_DEBUG("%"PRIu64" bytes of %s not in the crash file\n", n, what);
+    return FPRINTF(o, "\t  %"PRIu64" bytes of this %s are not in the crash file, "
+                   "and read as zero\n", n, what);
+}
+
 int print_64bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
                       const size_t count)
 {
+    IOStatScope stat_scope(IOSTAT_STACK);
+    uint64_t zero_fills = Memory::zero_fills();
     int len = 0;
     const int WS = 8; // Word size in bytes
     const int WPL = 4; // Words per line
@@ -78,12 +101,15 @@ int print_64bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
     }
 
     len += FPUTS("\n", o);
+    len += note_zero_fills(o, zero_fills, "stack");
     return len;
 }
 
 int print_32bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
                       const size_t count)
 {
+    IOStatScope stat_scope(IOSTAT_STACK);
+    uint64_t zero_fills = Memory::zero_fills();
     int len = 0;
     const int WS = 4; // Word size in bytes
     const int WPL = 8; // Words per line
@@ -134,6 +160,7 @@ int print_32bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
     }
 
     len += FPUTS("\n", o);
+    len += note_zero_fills(o, zero_fills, "stack");
     return len;
 }
 
@@ -259,6 +286,9 @@ int print_console_ring_3x(FILE * o, const PageTable & pt,
                           const vaddr_t log_buf, const uint64_t log_buf_len,
                           const uint64_t log_first_idx, const uint64_t log_next_idx)
 {
+    IOStatScope stat_scope(IOSTAT_CONSOLE);
+    uint64_t zero_fills = Memory::zero_fills();
+
     /*
      * struct log {
      *    [0] u64 ts_nsec;
@@ -327,6 +357,7 @@ int print_console_ring_3x(FILE * o, const PageTable & pt,
         e.log();
     }
 
+    len += note_zero_fills(o, zero_fills, "console ring");
     return len;
 }
 
@@ -334,6 +365,8 @@ int print_console_ring(FILE * o, const PageTable & pt,
                        const vaddr_t & ring, const uint64_t & _length,
                        const uint64_t & producer, const uint64_t & consumer)
 {
+    IOStatScope stat_scope(IOSTAT_CONSOLE);
+    uint64_t zero_fills = Memory::zero_fills();
     int len = 0;
     int64_t prod = producer, cons = consumer, length = _length;
     ssize_t written;
@@ -413,6 +446,7 @@ int print_console_ring(FILE * o, const PageTable & pt,
     }
 
     len += FPUTS("\n", o);
+    len += note_zero_fills(o, zero_fills, "console ring");
     return len;
 }
 